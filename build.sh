@@ -1,2 +1,4 @@
 mkdir -p build
-gcc -lm -g -fsanitize=undefined code/main.c -o build/vlisp
+gcc -lm -pthread -g -fsanitize=undefined code/main.c -o build/vlisp
+gcc -pthread -g -fPIC -DVLISP_LIBRARY -c code/main.c -o build/vlisp.o
+ar rcs build/libvlisp.a build/vlisp.o
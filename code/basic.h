@@ -20,3 +20,13 @@ typedef struct {
 static B32 strings_equal(String a, String b) {
   return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
 }
+
+// FNV-1a.
+static U64 hash_bytes(U8* data, U64 size) {
+  U64 hash = 0xCBF29CE484222325ull;
+  for (U64 i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ull;
+  }
+  return hash;
+}
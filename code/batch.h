@@ -0,0 +1,109 @@
+// A batch runs many small programs after one prelude. The prelude is
+// evaluated once, then each job runs in a forked copy of that interpreter, so
+// the prelude's arena is shared copy-on-write and a job starts without
+// parsing or evaluating anything but itself.
+//
+// A job writes its output to an unlinked temporary file rather than a pipe,
+// so it never waits for the batch to read it. The batch prints each job's
+// output and how it ended in the order the jobs were given, as soon as that
+// job and all before it are done.
+
+typedef struct {
+  char* path;
+  pid_t pid;
+  int   fd;
+  int   status;
+  B32   done;
+} Job;
+
+static void run_job(Context* context, char* path, int fd, B32 optimize) {
+  context_seed(context, time(NULL) ^ getpid());
+  assert(dup2(fd, STDOUT_FILENO) != -1);
+  close(fd);
+
+  if (context->arena.governor != NULL) {
+    governor_start(context->arena.governor);
+  }
+  evaluate_program(context, read_file(path), optimize);
+  flush(&context->output);
+}
+
+static void print_job(Context* context, Job* job) {
+  Output* output = &context->output;
+  print(output, string("== "));
+  print(output, string(job->path));
+  print(output, string(" ==\n"));
+  flush(output);
+
+  U8  buffer[65536];
+  I64 count;
+  assert(lseek(job->fd, 0, SEEK_SET) == 0);
+  while ((count = read(job->fd, buffer, sizeof buffer)) > 0) {
+    output_write(output, buffer, count);
+  }
+  assert(count == 0);
+  close(job->fd);
+
+  if (WIFEXITED(job->status) && WEXITSTATUS(job->status) != 0) {
+    print(output, string("== "));
+    print(output, string(job->path));
+    print(output, string(" exited with status "));
+    print_int(output, WEXITSTATUS(job->status));
+    print(output, string(" ==\n"));
+  } else if (WIFSIGNALED(job->status)) {
+    print(output, string("== "));
+    print(output, string(job->path));
+    print(output, string(" was killed by signal "));
+    print_int(output, WTERMSIG(job->status));
+    print(output, string(" ==\n"));
+  }
+}
+
+// Runs at most "concurrency" jobs at once and returns how many failed.
+static U64 run_batch(Context* context, char** paths, U64 count, U64 concurrency, B32 optimize) {
+  Job* jobs = (Job*) arena_allocate_bytes(&context->arena, count * sizeof(Job), _Alignof(Job), SITE_OTHER);
+  U64  started = 0;
+  U64  running = 0;
+  U64  printed = 0;
+  U64  failed  = 0;
+
+  while (printed < count) {
+    for (; started < count && running < concurrency; started++, running++) {
+      Job* job  = &jobs[started];
+      job->path = paths[started];
+      job->done = false;
+
+      char name[] = "/tmp/vlisp-job-XXXXXX";
+      job->fd = mkstemp(name);
+      assert(job->fd != -1);
+      unlink(name);
+
+      // Anything still buffered would be printed again by the job.
+      flush(&context->output);
+      job->pid = fork();
+      assert(job->pid != -1);
+      if (job->pid == 0) {
+	run_job(context, job->path, job->fd, optimize);
+	exit(EXIT_SUCCESS);
+      }
+    }
+
+    int   status;
+    pid_t pid = waitpid(-1, &status, 0);
+    assert(pid != -1);
+    for (U64 i = printed; i < started; i++) {
+      if (jobs[i].pid == pid) {
+	jobs[i].status = status;
+	jobs[i].done   = true;
+	running--;
+      }
+    }
+
+    for (; printed < started && jobs[printed].done; printed++) {
+      print_job(context, &jobs[printed]);
+      failed += jobs[printed].status != 0;
+    }
+  }
+  flush(&context->output);
+  return failed;
+}
@@ -1,11 +1,11 @@
-typedef Term* (*BuiltInFn)(Arena* arena, Values* values, Term* operands);
+typedef Term* (*BuiltInFn)(Context* context, Values* values, Term* operands);
 
-static Term* built_in_add(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_add(Context* context, Values* values, Term* operands) {
   B32 promoted = false;
   I64 sum      = 0;
   F64 fsum     = 0;
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
-    Term* operand = evaluate_term(arena, values, i->list.head).term;
+    Term* operand = evaluate_term(context, values, i->list.head).term;
     assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
     if (promoted) {
       fsum += operand->kind == TERM_INTEGER ? operand->integer : operand->number;
@@ -19,7 +19,7 @@ static Term* built_in_add(Arena* arena, Values* values, Term* operands) {
     }
   }
 
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   if (promoted) {
     result->kind   = TERM_NUMBER;
     result->number = fsum;
@@ -30,9 +30,9 @@ static Term* built_in_add(Arena* arena, Values* values, Term* operands) {
   return result;
 }
 
-static Term* built_in_subtract(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_subtract(Context* context, Values* values, Term* operands) {
   if (is_nil_term(operands->list.tail)) {
-    Term* result = evaluate_term(arena, values, operands->list.head).term;
+    Term* result = evaluate_term(context, values, operands->list.head).term;
     assert(result->kind == TERM_INTEGER || result->kind == TERM_NUMBER);
     if (result->kind == TERM_INTEGER) {
       result->integer *= -1;
@@ -46,7 +46,7 @@ static Term* built_in_subtract(Arena* arena, Values* values, Term* operands) {
   I64 sum      = 0;
   F64 fsum     = 0;
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
-    Term* operand = evaluate_term(arena, values, i->list.head).term;
+    Term* operand = evaluate_term(context, values, i->list.head).term;
     assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
     if (i == operands) {
       if (operand->kind == TERM_INTEGER) {
@@ -69,7 +69,7 @@ static Term* built_in_subtract(Arena* arena, Values* values, Term* operands) {
     }
   }
 
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   if (promoted) {
     result->kind   = TERM_NUMBER;
     result->number = fsum;
@@ -80,12 +80,12 @@ static Term* built_in_subtract(Arena* arena, Values* values, Term* operands) {
   return result;
 }
 
-static Term* built_in_multiply(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_multiply(Context* context, Values* values, Term* operands) {
   B32 promoted = false;
   I64 product  = 1;
   F64 fproduct = 1;
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
-    Term* operand = evaluate_term(arena, values, i->list.head).term;
+    Term* operand = evaluate_term(context, values, i->list.head).term;
     assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
     if (promoted) {
       fproduct *= operand->kind == TERM_INTEGER ? operand->integer : operand->number;
@@ -99,7 +99,7 @@ static Term* built_in_multiply(Arena* arena, Values* values, Term* operands) {
     }
   }
 
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   if (promoted) {
     result->kind   = TERM_NUMBER;
     result->number = fproduct;
@@ -110,12 +110,12 @@ static Term* built_in_multiply(Arena* arena, Values* values, Term* operands) {
   return result;
 }
 
-static Term* built_in_divide(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_divide(Context* context, Values* values, Term* operands) {
   B32 promoted = false;
   I64 product  = 1;
   F64 fproduct = 1;
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
-    Term* operand = evaluate_term(arena, values, i->list.head).term;
+    Term* operand = evaluate_term(context, values, i->list.head).term;
     assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
     if (i == operands) {
       if (operand->kind == TERM_INTEGER) {
@@ -138,7 +138,7 @@ static Term* built_in_divide(Arena* arena, Values* values, Term* operands) {
     }
   }
 
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   if (promoted) {
     result->kind   = TERM_NUMBER;
     result->number = fproduct;
@@ -149,11 +149,11 @@ static Term* built_in_divide(Arena* arena, Values* values, Term* operands) {
   return result;
 }
 
-static Term* built_in_less_than(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_less_than(Context* context, Values* values, Term* operands) {
   assert(operands->kind            == TERM_LIST);
   assert(operands->list.tail->kind == TERM_LIST);
-  Term* left  = evaluate_term(arena, values, operands->list.head).term;
-  Term* right = evaluate_term(arena, values, operands->list.tail->list.head).term;
+  Term* left  = evaluate_term(context, values, operands->list.head).term;
+  Term* right = evaluate_term(context, values, operands->list.tail->list.head).term;
   assert(left->kind  == TERM_INTEGER || left->kind  == TERM_NUMBER);
   assert(right->kind == TERM_INTEGER || right->kind == TERM_NUMBER);
 
@@ -168,14 +168,14 @@ static Term* built_in_less_than(Arena* arena, Values* values, Term* operands) {
       : left->number < right->number;
   }
   
-  return truth ? &term_t : &term_nil;
+  return truth ? &context->t : &context->nil;
 }
 
-static Term* built_in_equal(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_equal(Context* context, Values* values, Term* operands) {
   assert(operands->kind            == TERM_LIST);
   assert(operands->list.tail->kind == TERM_LIST);
-  Term* left  = evaluate_term(arena, values, operands->list.head).term;
-  Term* right = evaluate_term(arena, values, operands->list.tail->list.head).term;
+  Term* left  = evaluate_term(context, values, operands->list.head).term;
+  Term* right = evaluate_term(context, values, operands->list.tail->list.head).term;
   assert(left->kind  == TERM_INTEGER || left->kind  == TERM_NUMBER || left->kind == TERM_ATOM);
   assert(right->kind == TERM_INTEGER || right->kind == TERM_NUMBER || right->kind == TERM_ATOM);
 
@@ -192,14 +192,14 @@ static Term* built_in_equal(Arena* arena, Values* values, Term* operands) {
     truth = right->kind == TERM_ATOM && strings_equal(left->atom, right->atom);
   }
   
-  return truth ? &term_t : &term_nil;  
+  return truth ? &context->t : &context->nil;  
 }
 
-static Term* built_in_greater_than(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_greater_than(Context* context, Values* values, Term* operands) {
   assert(operands->kind            == TERM_LIST);
   assert(operands->list.tail->kind == TERM_LIST);
-  Term* left  = evaluate_term(arena, values, operands->list.head).term;
-  Term* right = evaluate_term(arena, values, operands->list.tail->list.head).term;
+  Term* left  = evaluate_term(context, values, operands->list.head).term;
+  Term* right = evaluate_term(context, values, operands->list.tail->list.head).term;
   assert(left->kind  == TERM_INTEGER || left->kind  == TERM_NUMBER);
   assert(right->kind == TERM_INTEGER || right->kind == TERM_NUMBER);
 
@@ -214,123 +214,121 @@ static Term* built_in_greater_than(Arena* arena, Values* values, Term* operands)
       : left->number > right->number;
   }
   
-  return truth ? &term_t : &term_nil;
+  return truth ? &context->t : &context->nil;
 }
 
-static Term* built_in_cond(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_cond(Context* context, Values* values, Term* operands) {
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
     assert(i->kind == TERM_LIST);
     Term* entry = i->list.head;
     assert(entry->kind == TERM_LIST);
-    Term* condition = evaluate_term(arena, values, entry->list.head).term;
+    Term* condition = evaluate_term(context, values, entry->list.head).term;
     if (condition->kind == TERM_LIST && !condition->list.head && !condition->list.tail) {
       continue;
     } else {
       assert(entry->list.tail->kind == TERM_LIST);
-      Term* value = evaluate_term(arena, values, entry->list.tail->list.head).term;
+      Term* value = evaluate_term(context, values, entry->list.tail->list.head).term;
       return value;
     }
   }
-  return &term_nil;
+  return &context->nil;
 }
 
-static Term* built_in_if(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_if(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(operands->list.tail->kind == TERM_LIST);
-  Term* condition = evaluate_term(arena, values, operands->list.head).term;
+  Term* condition = evaluate_term(context, values, operands->list.head).term;
   if (is_nil_term(condition)) {
     Term* rest = operands->list.tail->list.tail;
     if (is_nil_term(rest)) {
-      return &term_nil;
+      return &context->nil;
     } else {
-      return evaluate_term(arena, values, rest->list.head).term;
+      return evaluate_term(context, values, rest->list.head).term;
     }
   } else {
-    return evaluate_term(arena, values, operands->list.tail->list.head).term;
+    return evaluate_term(context, values, operands->list.tail->list.head).term;
   }
 }
 
-static Term* built_in_and(Arena* arena, Values* values, Term* operands) {
-  Term* value;
+static Term* built_in_and(Context* context, Values* values, Term* operands) {
+  Term* value = &context->t;
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
     assert(i->kind == TERM_LIST);
-    Term* entry = i->list.head;
-    value       = evaluate_term(arena, values, i->list.head).term;
+    value = evaluate_term(context, values, i->list.head).term;
     if (is_nil_term(value)) {
-      return &term_nil;
+      return &context->nil;
     }
   }
   return value;
 }
 
-static Term* built_in_or(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_or(Context* context, Values* values, Term* operands) {
   for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
     assert(i->kind == TERM_LIST);
-    Term* entry = i->list.head;
-    Term* value = evaluate_term(arena, values, i->list.head).term;
+    Term* value = evaluate_term(context, values, i->list.head).term;
     if (!is_nil_term(value)) {
       return value;
     }
   }
-  return &term_nil;
+  return &context->nil;
 }
 
-static Term* built_in_not(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_not(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(!is_nil_term(operands));
-  Term* operand = evaluate_term(arena, values, operands->list.head).term;
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
   if (is_nil_term(operand)) {
-    return &term_t;
+    return &context->t;
   } else {
-    return &term_nil;
+    return &context->nil;
   }
 }
 
-static Term* built_in_random(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_random(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(!is_nil_term(operands));
-  Term* operand = evaluate_term(arena, values, operands->list.head).term;
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
   assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   result->kind = operand->kind;
   if (operand->kind == TERM_INTEGER) {
-    result->integer = rand() % operand->integer;
+    result->integer = context_random(context) % operand->integer;
   } else {
-    result->number = fmod(rand(), operand->number);
+    result->number = fmod(context_random(context), operand->number);
   }
   return result;
 }
 
-static Term* built_in_runtime(Arena* arena, Values* values, Term* operands) {
-  Term* result    = arena_allocate(arena, Term);
+static Term* built_in_runtime(Context* context, Values* values, Term* operands) {
+  Term* result    = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   result->kind    = TERM_INTEGER;
   result->integer = clock() * 1000000 / CLOCKS_PER_SEC;
   return result;
 }
 
-static Term* built_in_display(Arena* arena, Values* values, Term* operands) {
-  Term* result = &term_nil;
+static Term* built_in_display(Context* context, Values* values, Term* operands) {
+  Term* result = &context->nil;
   for (Term* i = operands; !is_nil_term(i); i = i->list.tail) {
     assert(i->kind == TERM_LIST);
-    result = evaluate_term(arena, values, i->list.head).term;
+    result = evaluate_term(context, values, i->list.head).term;
     if (result->kind == TERM_STRING) {
-      print(result->string);
+      print(&context->output, result->string);
     } else {
-      print_term(result);
+      print_term(&context->output, result);
     }
   }
   return result;
 }
 
-static Term* built_in_remainder(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_remainder(Context* context, Values* values, Term* operands) {
   assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
-  Term* a = evaluate_term(arena, values, operands->list.head).term;
-  Term* b = evaluate_term(arena, values, operands->list.tail->list.head).term;
+  Term* a = evaluate_term(context, values, operands->list.head).term;
+  Term* b = evaluate_term(context, values, operands->list.tail->list.head).term;
   
   assert(a->kind == TERM_INTEGER || a->kind == TERM_NUMBER);
   assert(b->kind == TERM_INTEGER || b->kind == TERM_NUMBER);
 
-  Term* result = arena_allocate(arena, Term);
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   if (a->kind == TERM_INTEGER && b->kind == TERM_INTEGER) {
     result->kind    = TERM_INTEGER;
     result->integer = a->integer % b->integer;
@@ -343,40 +341,960 @@ static Term* built_in_remainder(Arena* arena, Values* values, Term* operands) {
   return result;
 }
 
-static Term* built_in_sin(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_sin(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(!is_nil_term(operands));
-  Term* operand = evaluate_term(arena, values, operands->list.head).term;
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
   assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
-  Term* result   = arena_allocate(arena, Term);
+  Term* result   = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   result->kind   = TERM_NUMBER;
   result->number = sin(operand->kind == TERM_INTEGER ? operand->integer : operand->number);
   return result;
 }
 
-static Term* built_in_cos(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_cos(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(!is_nil_term(operands));
-  Term* operand = evaluate_term(arena, values, operands->list.head).term;
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
   assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
-  Term* result   = arena_allocate(arena, Term);
+  Term* result   = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   result->kind   = TERM_NUMBER;
   result->number = cos(operand->kind == TERM_INTEGER ? operand->integer : operand->number);
   return result;
 }
 
-static Term* built_in_log(Arena* arena, Values* values, Term* operands) {
+static Term* built_in_log(Context* context, Values* values, Term* operands) {
   assert(operands->kind == TERM_LIST);
   assert(!is_nil_term(operands));
-  Term* operand = evaluate_term(arena, values, operands->list.head).term;
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
   assert(operand->kind == TERM_INTEGER || operand->kind == TERM_NUMBER);
-  Term* result   = arena_allocate(arena, Term);
+  Term* result   = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
   result->kind   = TERM_NUMBER;
   result->number = log(operand->kind == TERM_INTEGER ? operand->integer : operand->number);
   return result;
 }
 
-static String built_in_names[] = {
+static Term* evaluate_table(Context* context, Values* values, Term* operand) {
+  Term* table = evaluate_term(context, values, operand).term;
+  assert(table->kind == TERM_TABLE);
+  return table;
+}
+
+// Other values are copied whenever a name is evaluated, so a table could
+// never find them again.
+static Term* evaluate_key(Context* context, Values* values, Term* operands) {
+  assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
+  Term* key = evaluate_term(context, values, operands->list.tail->list.head).term;
+  if (!is_hashable_term(key)) {
+    print(&context->output, string("Only numbers, atoms and strings can be table keys, not "));
+    print_term(&context->output, key);
+    print(&context->output, string(".\n"));
+    fail(context);
+  }
+  return key;
+}
+
+static Term* built_in_make_table(Context* context, Values* values, Term* operands) {
+  Term* result  = arena_allocate(&context->arena, Term, SITE_TABLE);
+  result->kind  = TERM_TABLE;
+  result->table = table_create(&context->arena);
+  return result;
+}
+
+static Term* built_in_table_ref(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Table* table = evaluate_table(context, values, operands->list.head)->table;
+  Term*  key   = evaluate_key(context, values, operands);
+  Term*  value = table_get(table, key);
+  if (value != NULL) {
+    Term* result = arena_allocate(&context->arena, Term, SITE_VALUE);
+    *result      = *value;
+    return result;
+  }
+  Term* rest = operands->list.tail->list.tail;
+  return is_nil_term(rest) ? &context->nil : evaluate_term(context, values, rest->list.head).term;
+}
+
+static Term* built_in_table_set(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Table* table = evaluate_table(context, values, operands->list.head)->table;
+  Term*  key   = evaluate_key(context, values, operands);
+  Term*  rest  = operands->list.tail->list.tail;
+  assert(rest->kind == TERM_LIST && !is_nil_term(rest));
+  Term*  value = evaluate_term(context, values, rest->list.head).term;
+
+  table_set(&context->arena, table, key, value);
+  // The table now refers to memory that may be newer than it.
+  arena_pin(&context->arena);
+  return value;
+}
+
+static Term* built_in_table_delete(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Table* table = evaluate_table(context, values, operands->list.head)->table;
+  Term*  key   = evaluate_key(context, values, operands);
+  return table_remove(table, key) ? &context->t : &context->nil;
+}
+
+static Term* built_in_table_count(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Table* table    = evaluate_table(context, values, operands->list.head)->table;
+  Term*  result   = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
+  result->kind    = TERM_INTEGER;
+  result->integer = table->count;
+  return result;
+}
+
+// Lists the keys or the values of a table, in no particular order.
+static Term* table_entries(Context* context, Values* values, Term* operands, B32 keys) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Table* table = evaluate_table(context, values, operands->list.head)->table;
+  table_migrate(table, table->old_capacity);
+
+  Term* result = &context->nil;
+  for (U64 i = 0; i < table->capacity; i++) {
+    TableSlot* slot = &table->slots[i];
+    if (slot->key == NULL || slot->value == NULL) {
+      continue;
+    }
+    Term* new      = arena_allocate(&context->arena, Term, SITE_TABLE);
+    new->kind      = TERM_LIST;
+    new->list.head = keys ? slot->key : slot->value;
+    new->list.tail = result;
+    result         = new;
+  }
+  return result;
+}
+
+static Term* built_in_table_keys(Context* context, Values* values, Term* operands) {
+  return table_entries(context, values, operands, true);
+}
+
+static Term* built_in_table_values(Context* context, Values* values, Term* operands) {
+  return table_entries(context, values, operands, false);
+}
+
+static Term* make_integer(Context* context, I64 integer) {
+  Term* result    = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
+  result->kind    = TERM_INTEGER;
+  result->integer = integer;
+  return result;
+}
+
+static Term* make_number(Context* context, F64 number) {
+  Term* result   = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
+  result->kind   = TERM_NUMBER;
+  result->number = number;
+  return result;
+}
+
+static Term* make_vector_term(Context* context, Vector* vector) {
+  Term* result   = arena_allocate(&context->arena, Term, SITE_VECTOR);
+  result->kind   = TERM_VECTOR;
+  result->vector = vector;
+  return result;
+}
+
+static Term* evaluate_number(Context* context, Values* values, Term* operand) {
+  Term* number = evaluate_term(context, values, operand).term;
+  assert(number->kind == TERM_INTEGER || number->kind == TERM_NUMBER);
+  return number;
+}
+
+// A vector read from a file may not be parsed yet; see ingest.h.
+static Vector* evaluate_lazy_vector(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* vector = evaluate_term(context, values, operands->list.head).term;
+  assert(vector->kind == TERM_VECTOR);
+  return vector->vector;
+}
+
+static Vector* evaluate_vector(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_lazy_vector(context, values, operands);
+  vector_materialize(vector);
+  return vector;
+}
+
+static Term* second_operand(Term* operands) {
+  assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
+  return operands->list.tail;
+}
+
+// Builds a vector from its operands, which are all stored as floats if any
+// one of them is a float.
+static Term* built_in_vector(Context* context, Values* values, Term* operands) {
+  U64 count = 0;
+  for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
+    count++;
+  }
+  Term**   elements = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_VECTOR);
+  TermKind kind     = TERM_INTEGER;
+  U64      index    = 0;
+  for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
+    elements[index] = evaluate_number(context, values, i->list.head);
+    if (elements[index]->kind == TERM_NUMBER) {
+      kind = TERM_NUMBER;
+    }
+    index++;
+  }
+
+  Vector* vector = vector_create(&context->arena, kind, count);
+  for (U64 j = 0; j < count; j++) {
+    if (kind == TERM_INTEGER) {
+      vector->integers[j] = elements[j]->integer;
+    } else {
+      vector->numbers[j] = elements[j]->kind == TERM_INTEGER ? elements[j]->integer : elements[j]->number;
+    }
+  }
+  return make_vector_term(context, vector);
+}
+
+static Term* built_in_make_vector(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* count = evaluate_number(context, values, operands->list.head);
+  assert(count->kind == TERM_INTEGER && count->integer >= 0);
+  Term* rest  = operands->list.tail;
+  Term* fill  = is_nil_term(rest) ? NULL : evaluate_number(context, values, rest->list.head);
+
+  Vector* vector = vector_create(&context->arena, fill != NULL ? fill->kind : TERM_INTEGER, count->integer);
+  for (U64 i = 0; i < vector->count; i++) {
+    if (vector->kind == TERM_INTEGER) {
+      vector->integers[i] = fill != NULL ? fill->integer : 0;
+    } else {
+      vector->numbers[i] = fill->number;
+    }
+  }
+  return make_vector_term(context, vector);
+}
+
+// (vector-range n) is the integers from 0 to n - 1.
+static Term* built_in_vector_range(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* count = evaluate_number(context, values, operands->list.head);
+  assert(count->kind == TERM_INTEGER && count->integer >= 0);
+  Vector* vector = vector_create(&context->arena, TERM_INTEGER, count->integer);
+  for (U64 i = 0; i < vector->count; i++) {
+    vector->integers[i] = i;
+  }
+  return make_vector_term(context, vector);
+}
+
+static Term* built_in_vector_length(Context* context, Values* values, Term* operands) {
+  return make_integer(context, evaluate_lazy_vector(context, values, operands)->count);
+}
+
+static U64 evaluate_index(Context* context, Values* values, Term* operands, Vector* vector) {
+  Term* index = evaluate_number(context, values, second_operand(operands)->list.head);
+  assert(index->kind == TERM_INTEGER && index->integer >= 0 && (U64) index->integer < vector->count);
+  vector_touch(vector, index->integer);
+  return index->integer;
+}
+
+static Term* built_in_vector_ref(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_lazy_vector(context, values, operands);
+  U64     index  = evaluate_index(context, values, operands, vector);
+  return vector->kind == TERM_INTEGER
+    ? make_integer(context, vector->integers[index])
+    : make_number(context, vector->numbers[index]);
+}
+
+// Elements are stored unboxed, so unlike table-set! nothing needs pinning.
+static Term* built_in_vector_set(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_lazy_vector(context, values, operands);
+  U64     index  = evaluate_index(context, values, operands, vector);
+  Term*   rest   = second_operand(operands)->list.tail;
+  assert(rest->kind == TERM_LIST && !is_nil_term(rest));
+  Term*   value  = evaluate_number(context, values, rest->list.head);
+
+  if (vector->kind == TERM_INTEGER) {
+    assert(value->kind == TERM_INTEGER);
+    vector->integers[index] = value->integer;
+  } else {
+    vector->numbers[index] = value->kind == TERM_INTEGER ? value->integer : value->number;
+  }
+  return value;
+}
+
+static Term* built_in_vector_sum(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_vector(context, values, operands);
+  return vector->kind == TERM_INTEGER
+    ? make_integer(context, context->kernels->sum_integers(vector->integers, vector->count))
+    : make_number(context, context->kernels->sum(vector->numbers, vector->count));
+}
+
+static Term* built_in_vector_dot(Context* context, Values* values, Term* operands) {
+  Vector* a = evaluate_vector(context, values, operands);
+  Vector* b = evaluate_vector(context, values, second_operand(operands));
+  assert(a->count == b->count);
+  if (a->kind == TERM_INTEGER && b->kind == TERM_INTEGER) {
+    U64 sum = 0;
+    for (U64 i = 0; i < a->count; i++) {
+      sum += (U64) a->integers[i] * (U64) b->integers[i];
+    }
+    return make_integer(context, sum);
+  }
+  a = vector_promote(&context->arena, a);
+  b = vector_promote(&context->arena, b);
+  return make_number(context, context->kernels->dot(a->numbers, b->numbers, a->count));
+}
+
+// Adds or multiplies two vectors of the same length element by element.
+static Term* vector_elementwise(Context* context, Values* values, Term* operands, B32 add) {
+  Vector* a = evaluate_vector(context, values, operands);
+  Vector* b = evaluate_vector(context, values, second_operand(operands));
+  assert(a->count == b->count);
+  if (a->kind == TERM_INTEGER && b->kind == TERM_INTEGER) {
+    Vector* result = vector_create(&context->arena, TERM_INTEGER, a->count);
+    for (U64 i = 0; i < a->count; i++) {
+      result->integers[i] = add
+	? (U64) a->integers[i] + (U64) b->integers[i]
+	: (U64) a->integers[i] * (U64) b->integers[i];
+    }
+    return make_vector_term(context, result);
+  }
+  a = vector_promote(&context->arena, a);
+  b = vector_promote(&context->arena, b);
+  Vector* result = vector_create(&context->arena, TERM_NUMBER, a->count);
+  if (add) {
+    context->kernels->add(result->numbers, a->numbers, b->numbers, a->count);
+  } else {
+    context->kernels->multiply(result->numbers, a->numbers, b->numbers, a->count);
+  }
+  return make_vector_term(context, result);
+}
+
+static Term* built_in_vector_add(Context* context, Values* values, Term* operands) {
+  return vector_elementwise(context, values, operands, true);
+}
+
+static Term* built_in_vector_multiply(Context* context, Values* values, Term* operands) {
+  return vector_elementwise(context, values, operands, false);
+}
+
+static Term* built_in_vector_scale(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_vector(context, values, operands);
+  Term*   factor = evaluate_number(context, values, second_operand(operands)->list.head);
+  if (vector->kind == TERM_INTEGER && factor->kind == TERM_INTEGER) {
+    Vector* result = vector_create(&context->arena, TERM_INTEGER, vector->count);
+    for (U64 i = 0; i < vector->count; i++) {
+      result->integers[i] = (U64) vector->integers[i] * (U64) factor->integer;
+    }
+    return make_vector_term(context, result);
+  }
+  vector = vector_promote(&context->arena, vector);
+  F64     k      = factor->kind == TERM_INTEGER ? factor->integer : factor->number;
+  Vector* result = vector_create(&context->arena, TERM_NUMBER, vector->count);
+  context->kernels->scale(result->numbers, vector->numbers, k, vector->count);
+  return make_vector_term(context, result);
+}
+
+static Term* vector_extreme(Context* context, Values* values, Term* operands, B32 minimum) {
+  Vector* vector = evaluate_vector(context, values, operands);
+  assert(vector->count > 0);
+  if (vector->kind == TERM_INTEGER) {
+    I64 result = vector->integers[0];
+    for (U64 i = 1; i < vector->count; i++) {
+      I64 element = vector->integers[i];
+      result = (minimum ? element < result : element > result) ? element : result;
+    }
+    return make_integer(context, result);
+  }
+  return make_number(context, minimum
+		     ? context->kernels->min(vector->numbers, vector->count)
+		     : context->kernels->max(vector->numbers, vector->count));
+}
+
+static Term* built_in_vector_min(Context* context, Values* values, Term* operands) {
+  return vector_extreme(context, values, operands, true);
+}
+
+static Term* built_in_vector_max(Context* context, Values* values, Term* operands) {
+  return vector_extreme(context, values, operands, false);
+}
+
+// Element i of the result is the sum of elements 0 to i, added in order.
+static Term* built_in_vector_prefix_sum(Context* context, Values* values, Term* operands) {
+  Vector* vector = evaluate_vector(context, values, operands);
+  Vector* result = vector_create(&context->arena, vector->kind, vector->count);
+  if (vector->kind == TERM_INTEGER) {
+    U64 sum = 0;
+    for (U64 i = 0; i < vector->count; i++) {
+      sum += (U64) vector->integers[i];
+      result->integers[i] = sum;
+    }
+  } else {
+    F64 sum = 0;
+    for (U64 i = 0; i < vector->count; i++) {
+      sum += vector->numbers[i];
+      result->numbers[i] = sum;
+    }
+  }
+  return make_vector_term(context, result);
+}
+
+static Term* vector_map(Context* context, Values* values, Term* operands, F64 (*function)(F64)) {
+  Vector* vector = vector_promote(&context->arena, evaluate_vector(context, values, operands));
+  Vector* result = vector_create(&context->arena, TERM_NUMBER, vector->count);
+  for (U64 i = 0; i < vector->count; i++) {
+    result->numbers[i] = function(vector->numbers[i]);
+  }
+  return make_vector_term(context, result);
+}
+
+static Term* built_in_vector_sin(Context* context, Values* values, Term* operands) {
+  return vector_map(context, values, operands, sin);
+}
+
+static Term* built_in_vector_cos(Context* context, Values* values, Term* operands) {
+  return vector_map(context, values, operands, cos);
+}
+
+static Term* built_in_vector_log(Context* context, Values* values, Term* operands) {
+  return vector_map(context, values, operands, log);
+}
+
+// Forcing stores a value newer than the promise in it, so the promise is
+// pinned; a stream built and consumed within one form is still released.
+static Term* force_promise(Context* context, Promise* promise) {
+  if (promise->value == NULL) {
+    Term* value = evaluate_term(context, promise->values, promise->expression).term;
+    // Forcing the expression may have forced this promise already.
+    if (promise->value == NULL) {
+      promise->value  = value;
+      promise->values = NULL;
+      arena_pin_object(&context->arena, promise);
+    }
+  }
+  return promise->value;
+}
+
+static Term* built_in_force(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* operand = evaluate_term(context, values, operands->list.head).term;
+  if (operand->kind != TERM_PROMISE) {
+    return operand;
+  }
+  Term* result = arena_allocate(&context->arena, Term, SITE_VALUE);
+  *result      = *force_promise(context, operand->promise);
+  return result;
+}
+
+static Term* make_built_in(Context* context, BuiltInFn function);
+
+// A stream is either nil or a list whose tail is a promise of the rest.
+static Term* evaluate_stream(Context* context, Values* values, Term* operand) {
+  Term* stream = evaluate_term(context, values, operand).term;
+  assert(is_nil_term(stream) || (stream->kind == TERM_LIST && stream->list.tail->kind == TERM_PROMISE));
+  return stream;
+}
+
+static Term* stream_rest(Context* context, Term* stream) {
+  Term* rest = force_promise(context, stream->list.tail->promise);
+  assert(is_nil_term(rest) || (rest->kind == TERM_LIST && rest->list.tail->kind == TERM_PROMISE));
+  return rest;
+}
+
+static Term* make_list2(Context* context, Term* first, Term* second) {
+  Term* tail      = arena_allocate(&context->arena, Term, SITE_STREAM);
+  tail->kind      = TERM_LIST;
+  tail->list.head = second;
+  tail->list.tail = &context->nil;
+
+  Term* list      = arena_allocate(&context->arena, Term, SITE_STREAM);
+  list->kind      = TERM_LIST;
+  list->list.head = first;
+  list->list.tail = tail;
+  return list;
+}
+
+// Allocates "count" list cells in one block, linked in order and ending in
+// "tail". The caller fills in the heads.
+static Term* make_cells(Context* context, U64 count, Term* tail) {
+  if (count == 0) {
+    return tail;
+  }
+  Term* cells = (Term*) arena_allocate_bytes(&context->arena, count * sizeof(Term), _Alignof(Term), SITE_LIST);
+  for (U64 i = 0; i < count; i++) {
+    cells[i].kind      = TERM_LIST;
+    cells[i].list.head = NULL;
+    cells[i].list.tail = i + 1 < count ? &cells[i + 1] : tail;
+  }
+  return cells;
+}
+
+// Builds the expression (function (force promise) ...) with one promise per
+// argument, already forced to it, so no argument is evaluated again.
+static Term* make_application(Context* context, Term* function, Term** arguments, U64 count) {
+  Term* call      = make_cells(context, count + 1, &context->nil);
+  call->list.head = function;
+  for (U64 i = 0; i < count; i++) {
+    Term* promise           = make_promise(&context->arena, NULL, NULL);
+    promise->promise->value = arguments[i];
+    call[i + 1].list.head   = make_list2(context, make_built_in(context, built_in_force), promise);
+  }
+  return call;
+}
+
+// The rest of a stream built by "function" from "stream", as a promise of
+// (function procedure (force rest-of-stream)).
+static Term* make_stream(Context* context, Values* values, Term* first, BuiltInFn function, Term* procedure, Term* stream) {
+  Term* rest       = make_list2(context, make_built_in(context, built_in_force), stream->list.tail);
+  Term* expression = make_list2(context, procedure, rest);
+  Term* call       = arena_allocate(&context->arena, Term, SITE_STREAM);
+  call->kind       = TERM_LIST;
+  call->list.head  = make_built_in(context, function);
+  call->list.tail  = expression;
+
+  Term* result      = arena_allocate(&context->arena, Term, SITE_STREAM);
+  result->kind      = TERM_LIST;
+  result->list.head = first;
+  result->list.tail = make_promise(&context->arena, values, call);
+  return result;
+}
+
+static Term* built_in_stream_car(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* stream = evaluate_stream(context, values, operands->list.head);
+  assert(!is_nil_term(stream));
+  Term* result = arena_allocate(&context->arena, Term, SITE_VALUE);
+  *result      = *stream->list.head;
+  return result;
+}
+
+static Term* built_in_stream_cdr(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* stream = evaluate_stream(context, values, operands->list.head);
+  assert(!is_nil_term(stream));
+  return stream_rest(context, stream);
+}
+
+static Term* built_in_stream_null(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  return is_nil_term(evaluate_stream(context, values, operands->list.head)) ? &context->t : &context->nil;
+}
+
+static Term* built_in_stream_ref(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* stream = evaluate_stream(context, values, operands->list.head);
+  assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
+  Term* index  = evaluate_term(context, values, operands->list.tail->list.head).term;
+  assert(index->kind == TERM_INTEGER && index->integer >= 0);
+
+  for (I64 i = 0; i < index->integer; i++) {
+    assert(!is_nil_term(stream));
+    stream = stream_rest(context, stream);
+  }
+  assert(!is_nil_term(stream));
+  Term* result = arena_allocate(&context->arena, Term, SITE_VALUE);
+  *result      = *stream->list.head;
+  return result;
+}
+
+// (stream-map procedure stream) applies "procedure" to the first element now
+// and to each later one when the stream is forced that far.
+static Term* built_in_stream_map(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* procedure = evaluate_term(context, values, operands->list.head).term;
+  assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
+  Term* stream    = evaluate_stream(context, values, operands->list.tail->list.head);
+  if (is_nil_term(stream)) {
+    return &context->nil;
+  }
+  Term* first = apply(context, values, procedure, &stream->list.head, 1);
+  return make_stream(context, values, first, built_in_stream_map, procedure, stream);
+}
+
+// (stream-filter predicate stream) forces the stream up to the first element
+// "predicate" accepts and no further.
+static Term* built_in_stream_filter(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* predicate = evaluate_term(context, values, operands->list.head).term;
+  assert(operands->list.tail->kind == TERM_LIST && !is_nil_term(operands->list.tail));
+  Term* stream    = evaluate_stream(context, values, operands->list.tail->list.head);
+  for (; !is_nil_term(stream); stream = stream_rest(context, stream)) {
+    if (!is_nil_term(apply(context, values, predicate, &stream->list.head, 1))) {
+      return make_stream(context, values, stream->list.head, built_in_stream_filter, predicate, stream);
+    }
+  }
+  return &context->nil;
+}
+
+static Term* evaluate_list(Context* context, Values* values, Term* operand) {
+  Term* list = evaluate_term(context, values, operand).term;
+  assert(list->kind == TERM_LIST);
+  return list;
+}
+
+static U64 count_list(Term* list) {
+  U64 count = 0;
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    assert(i->kind == TERM_LIST);
+    count++;
+  }
+  return count;
+}
+
+static Term* built_in_cons(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* head = evaluate_term(context, values, operands->list.head).term;
+  Term* tail = evaluate_term(context, values, second_operand(operands)->list.head).term;
+  Term* cell = make_cells(context, 1, tail);
+  cell->list.head = head;
+  return cell;
+}
+
+static Term* built_in_car(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* list = evaluate_list(context, values, operands->list.head);
+  assert(!is_nil_term(list));
+  Term* result = arena_allocate(&context->arena, Term, SITE_VALUE);
+  *result      = *list->list.head;
+  return result;
+}
+
+static Term* built_in_cdr(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* list = evaluate_list(context, values, operands->list.head);
+  assert(!is_nil_term(list));
+  return list->list.tail;
+}
+
+static Term* built_in_list(Context* context, Values* values, Term* operands) {
+  U64   count = count_list(operands);
+  Term* cells = make_cells(context, count, &context->nil);
+  U64   index = 0;
+  for (Term* i = operands; !is_nil_term(i); i = i->list.tail) {
+    cells[index++].list.head = evaluate_term(context, values, i->list.head).term;
+  }
+  return cells;
+}
+
+static Term* built_in_null(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  return is_nil_term(evaluate_term(context, values, operands->list.head).term) ? &context->t : &context->nil;
+}
+
+static Term* built_in_length(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  return make_integer(context, count_list(evaluate_list(context, values, operands->list.head)));
+}
+
+// Copies every list but the last, which the result shares.
+static Term* built_in_append(Context* context, Values* values, Term* operands) {
+  U64    count = count_list(operands);
+  Term** lists = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_LIST);
+  U64    total = 0;
+  U64    index = 0;
+  for (Term* i = operands; !is_nil_term(i); i = i->list.tail) {
+    Term* list     = evaluate_term(context, values, i->list.head).term;
+    lists[index++] = list;
+    if (index < count) {
+      assert(list->kind == TERM_LIST);
+      total += count_list(list);
+    }
+  }
+  if (count == 0) {
+    return &context->nil;
+  }
+
+  Term* cells = make_cells(context, total, lists[count - 1]);
+  U64   cell  = 0;
+  for (U64 j = 0; j + 1 < count; j++) {
+    for (Term* i = lists[j]; !is_nil_term(i); i = i->list.tail) {
+      cells[cell++].list.head = i->list.head;
+    }
+  }
+  return cells;
+}
+
+static Term* built_in_reverse(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* list  = evaluate_list(context, values, operands->list.head);
+  U64   count = count_list(list);
+  Term* cells = make_cells(context, count, &context->nil);
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    cells[--count].list.head = i->list.head;
+  }
+  return cells;
+}
+
+// The result cells are allocated before the procedure runs. Storing results
+// newer than them needs no pinning: every mark still in use is either older
+// than the cells or is taken by "apply" and restored before the store.
+static Term* built_in_map(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* function = evaluate_term(context, values, operands->list.head).term;
+  Term* list     = evaluate_list(context, values, second_operand(operands)->list.head);
+  Term* cells    = make_cells(context, count_list(list), &context->nil);
+  U64   index    = 0;
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    cells[index++].list.head = apply(context, values, function, &i->list.head, 1);
+  }
+  return cells;
+}
+
+// Keeps the elements "predicate" accepts, in order. Cells for every element
+// are allocated up front and the unused ones are left behind.
+static Term* built_in_filter(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* predicate = evaluate_term(context, values, operands->list.head).term;
+  Term* list      = evaluate_list(context, values, second_operand(operands)->list.head);
+  U64   count     = count_list(list);
+  Term* cells     = make_cells(context, count, &context->nil);
+  U64   kept      = 0;
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    if (!is_nil_term(apply(context, values, predicate, &i->list.head, 1))) {
+      cells[kept++].list.head = i->list.head;
+    }
+  }
+  if (kept == 0) {
+    return &context->nil;
+  }
+  cells[kept - 1].list.tail = &context->nil;
+  return cells;
+}
+
+// (fold f initial list) is (f (f initial x1) x2) and so on, from the left.
+static Term* built_in_fold(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* function = evaluate_term(context, values, operands->list.head).term;
+  Term* rest     = second_operand(operands);
+  Term* result   = evaluate_term(context, values, rest->list.head).term;
+  assert(rest->list.tail->kind == TERM_LIST && !is_nil_term(rest->list.tail));
+  Term* list     = evaluate_list(context, values, rest->list.tail->list.head);
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    Term* arguments[2] = { result, i->list.head };
+    result = apply(context, values, function, arguments, 2);
+  }
+  return result;
+}
+
+// (fold-right f initial list) is (f x1 (f x2 ... (f xn initial))).
+static Term* built_in_fold_right(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* function = evaluate_term(context, values, operands->list.head).term;
+  Term* rest     = second_operand(operands);
+  Term* result   = evaluate_term(context, values, rest->list.head).term;
+  assert(rest->list.tail->kind == TERM_LIST && !is_nil_term(rest->list.tail));
+  Term* list     = evaluate_list(context, values, rest->list.tail->list.head);
+
+  U64    count    = count_list(list);
+  Term** elements = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_LIST);
+  U64    index    = 0;
+  for (Term* i = list; !is_nil_term(i); i = i->list.tail) {
+    elements[index++] = i->list.head;
+  }
+  while (count > 0) {
+    Term* arguments[2] = { elements[--count], result };
+    result = apply(context, values, function, arguments, 2);
+  }
+  return result;
+}
+
+// The reader works on data as it does on programs. Atoms, and strings without
+// escapes, point into the text read rather than being copied, so a file is
+// mapped and parsed in place. It is unmapped when the memory of the terms
+// parsed from it is released.
+static String map_input(Arena* arena, int fd) {
+  struct stat info;
+  assert(fstat(fd, &info) == 0);
+  if (!S_ISREG(info.st_mode) || info.st_size == 0) {
+    return read_all(arena, fd);
+  }
+  U8* data = arena_map(arena, fd, info.st_size, PROT_READ);
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  return (String) { .data = data, .size = info.st_size };
+}
+
+// Parses the next datum of "input" and moves past it. At the end of the input
+// it returns the atom eof.
+static Term* read_datum(Context* context, String* input) {
+  *input = clear_blanks(*input);
+  if (input->size == 0) {
+    Term* eof = arena_allocate(&context->arena, Term, SITE_PARSER);
+    eof->kind = TERM_ATOM;
+    eof->atom = string("eof");
+    return eof;
+  }
+  ParseResult parsed = parse(&context->arena, *input);
+  *input             = parsed.rest;
+  return parsed.term;
+}
+
+static String evaluate_string(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* text = evaluate_term(context, values, operands->list.head).term;
+  assert(text->kind == TERM_STRING);
+  return text->string;
+}
+
+// Reads standard input, which is loaded the first time and kept for good.
+static Term* built_in_read(Context* context, Values* values, Term* operands) {
+  assert(is_nil_term(operands));
+  if (!context->input_loaded) {
+    context->input        = map_input(&context->arena, STDIN_FILENO);
+    context->input_loaded = true;
+    arena_pin(&context->arena);
+  }
+  return read_datum(context, &context->input);
+}
+
+static Term* built_in_read_from_string(Context* context, Values* values, Term* operands) {
+  String text = evaluate_string(context, values, operands);
+  return read_datum(context, &text);
+}
+
+// Opens the file named by the first operand.
+static int evaluate_file(Context* context, Values* values, Term* operands) {
+  String name = evaluate_string(context, values, operands);
+  char*  path = (char*) arena_allocate_bytes(&context->arena, name.size + 1, 1, SITE_OTHER);
+  memcpy(path, name.data, name.size);
+  path[name.size] = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    print(&context->output, string("Could not read "));
+    print(&context->output, name);
+    print(&context->output, string(".\n"));
+    fail(context);
+  }
+  return fd;
+}
+
+// Returns every datum in the file, in a list.
+static Term* built_in_read_file(Context* context, Values* values, Term* operands) {
+  int    fd    = evaluate_file(context, values, operands);
+  String input = clear_blanks(map_input(&context->arena, fd));
+  close(fd);
+
+  Term*  result = &context->nil;
+  Term** last   = &result;
+  while (input.size > 0) {
+    ParseResult parsed = parse(&context->arena, input);
+    Term*       cell   = make_cells(context, 1, &context->nil);
+    cell->list.head    = parsed.term;
+    *last              = cell;
+    last               = &cell->list.tail;
+    input              = clear_blanks(parsed.rest);
+  }
+  return result;
+}
+
+// (read-binary-vector path type) views a file of "f64" or "i64" elements.
+static Term* built_in_read_binary_vector(Context* context, Values* values, Term* operands) {
+  int    fd   = evaluate_file(context, values, operands);
+  String type = evaluate_string(context, values, second_operand(operands));
+  assert(strings_equal(type, string("f64")) || strings_equal(type, string("i64")));
+  Vector* vector = vector_map_binary(
+    &context->arena, fd, strings_equal(type, string("f64")) ? TERM_NUMBER : TERM_INTEGER
+  );
+  close(fd);
+  return make_vector_term(context, vector);
+}
+
+// (read-csv-vector path column [header-lines]) reads a column of a CSV file,
+// counting from 0, skipping the header lines first.
+static Term* built_in_read_csv_vector(Context* context, Values* values, Term* operands) {
+  int   fd     = evaluate_file(context, values, operands);
+  Term* rest   = second_operand(operands);
+  Term* column = evaluate_number(context, values, rest->list.head);
+  assert(column->kind == TERM_INTEGER && column->integer >= 0);
+  rest         = rest->list.tail;
+  Term* skip   = is_nil_term(rest) ? NULL : evaluate_number(context, values, rest->list.head);
+  assert(skip == NULL || (skip->kind == TERM_INTEGER && skip->integer >= 0));
+  Vector* vector = vector_map_csv(&context->arena, fd, column->integer, skip != NULL ? skip->integer : 0);
+  close(fd);
+  return make_vector_term(context, vector);
+}
+
+#define BENCHMARK_WARMUP_NS  100000000ull
+#define BENCHMARK_TIME_NS    1000000000ull
+#define BENCHMARK_MOST_CALLS 1000000ull
+
+static int compare_samples(const void* a, const void* b) {
+  U64 x = *(const U64*) a;
+  U64 y = *(const U64*) b;
+  return x < y ? -1 : x > y;
+}
+
+// Calls "thunk" once and returns how long it took, in nanoseconds. Whatever
+// the call left on the arena is given back when nothing can refer to it.
+static U64 benchmark_call(Context* context, Values* values, Term* thunk, U64* bytes) {
+  Arena* arena     = &context->arena;
+  U64    mark      = arena_mark(arena);
+  U64    allocated = arena->allocated;
+  U64    started   = governor_now();
+  apply(context, values, thunk, NULL, 0);
+  U64    elapsed   = governor_now() - started;
+  *bytes += arena->allocated - allocated;
+  if (arena_releasable(arena, mark)) {
+    arena_restore(arena, mark);
+  }
+  return elapsed;
+}
+
+// (benchmark thunk [iterations]) calls thunk for a tenth of a second to warm
+// up, then "iterations" more times, or as many as fit in about a second, and
+// prints how long the calls took on the monotonic clock and how many bytes
+// each allocated. Returns the mean time in microseconds.
+static Term* built_in_benchmark(Context* context, Values* values, Term* operands) {
+  assert(operands->kind == TERM_LIST && !is_nil_term(operands));
+  Term* thunk = evaluate_term(context, values, operands->list.head).term;
+  Term* rest  = operands->list.tail;
+  Term* given = is_nil_term(rest) ? NULL : evaluate_number(context, values, rest->list.head);
+  assert(given == NULL || (given->kind == TERM_INTEGER && given->integer > 0));
+
+  U64 bytes   = 0;
+  U64 warmup  = 0;
+  U64 elapsed = 0;
+  while (warmup == 0 || elapsed < BENCHMARK_WARMUP_NS) {
+    elapsed += benchmark_call(context, values, thunk, &bytes);
+    warmup++;
+  }
+  U64 count = given != NULL ? (U64) given->integer : BENCHMARK_TIME_NS / (elapsed / warmup + 1);
+  if (given == NULL && count > BENCHMARK_MOST_CALLS) {
+    count = BENCHMARK_MOST_CALLS;
+  }
+  if (count == 0) {
+    count = 1;
+  }
+
+  Arena* arena   = &context->arena;
+  U64    mark    = arena_mark(arena);
+  U64*   samples = (U64*) arena_allocate_bytes(arena, count * sizeof(U64), _Alignof(U64), SITE_OTHER);
+  U64    total   = 0;
+  bytes = 0;
+  for (U64 i = 0; i < count; i++) {
+    samples[i] = benchmark_call(context, values, thunk, &bytes);
+    total     += samples[i];
+  }
+  qsort(samples, count, sizeof(U64), compare_samples);
+
+  // The 99th percentile is the smallest sample at least 99% of them reach.
+  F64     mean   = (F64) total / count;
+  U64     median = samples[count / 2];
+  U64     p99    = samples[(count * 99 + 99) / 100 - 1];
+  Output* output = &context->output;
+  print(output, string("benchmark: "));
+  print_int(output, count);
+  print(output, string(" iterations, mean "));
+  print_float(output, mean / 1e3);
+  print(output, string(" us, median "));
+  print_float(output, median / 1e3);
+  print(output, string(" us, p99 "));
+  print_float(output, p99 / 1e3);
+  print(output, string(" us, "));
+  print_float(output, mean > 0 ? 1e9 / mean : INFINITY);
+  print(output, string(" per second, "));
+  print_int(output, bytes / count);
+  print(output, string(" bytes per iteration\n"));
+  if (arena_releasable(arena, mark)) {
+    arena_restore(arena, mark);
+  }
+  return make_number(context, mean / 1e3);
+}
+
+static const String built_in_names[] = {
   string("+"),
   string("-"),
   string("*"),
@@ -396,9 +1314,58 @@ static String built_in_names[] = {
   string("sin"),
   string("cos"),
   string("log"),
+  string("make-table"),
+  string("table-ref"),
+  string("table-set!"),
+  string("table-delete!"),
+  string("table-count"),
+  string("table-keys"),
+  string("table-values"),
+  string("vector"),
+  string("make-vector"),
+  string("vector-range"),
+  string("vector-length"),
+  string("vector-ref"),
+  string("vector-set!"),
+  string("vector-sum"),
+  string("vector-dot"),
+  string("vector-add"),
+  string("vector-mul"),
+  string("vector-scale"),
+  string("vector-min"),
+  string("vector-max"),
+  string("vector-prefix-sum"),
+  string("vector-sin"),
+  string("vector-cos"),
+  string("vector-log"),
+  string("force"),
+  string("stream-car"),
+  string("stream-cdr"),
+  string("stream-null?"),
+  string("stream-ref"),
+  string("stream-map"),
+  string("stream-filter"),
+  string("cons"),
+  string("car"),
+  string("cdr"),
+  string("list"),
+  string("null?"),
+  string("length"),
+  string("append"),
+  string("reverse"),
+  string("map"),
+  string("filter"),
+  string("fold"),
+  string("fold-right"),
+  string("read"),
+  string("read-from-string"),
+  string("read-file"),
+  string("read-binary-vector"),
+  string("read-csv-vector"),
+  string("benchmark"),
 };
 
-static BuiltInFn built_ins[] = {
+static const BuiltInFn built_ins[] = {
   built_in_add,
   built_in_subtract,
   built_in_multiply,
@@ -418,5 +1385,64 @@ static BuiltInFn built_ins[] = {
   built_in_sin,
   built_in_cos,
   built_in_log,
+  built_in_make_table,
+  built_in_table_ref,
+  built_in_table_set,
+  built_in_table_delete,
+  built_in_table_count,
+  built_in_table_keys,
+  built_in_table_values,
+  built_in_vector,
+  built_in_make_vector,
+  built_in_vector_range,
+  built_in_vector_length,
+  built_in_vector_ref,
+  built_in_vector_set,
+  built_in_vector_sum,
+  built_in_vector_dot,
+  built_in_vector_add,
+  built_in_vector_multiply,
+  built_in_vector_scale,
+  built_in_vector_min,
+  built_in_vector_max,
+  built_in_vector_prefix_sum,
+  built_in_vector_sin,
+  built_in_vector_cos,
+  built_in_vector_log,
+  built_in_force,
+  built_in_stream_car,
+  built_in_stream_cdr,
+  built_in_stream_null,
+  built_in_stream_ref,
+  built_in_stream_map,
+  built_in_stream_filter,
+  built_in_cons,
+  built_in_car,
+  built_in_cdr,
+  built_in_list,
+  built_in_null,
+  built_in_length,
+  built_in_append,
+  built_in_reverse,
+  built_in_map,
+  built_in_filter,
+  built_in_fold,
+  built_in_fold_right,
+  built_in_read,
+  built_in_read_from_string,
+  built_in_read_file,
+  built_in_read_binary_vector,
+  built_in_read_csv_vector,
+  built_in_benchmark,
 };
 
+static Term* make_built_in(Context* context, BuiltInFn function) {
+  U64 index = 0;
+  while (built_ins[index] != function) {
+    index++;
+  }
+  Term* result     = arena_allocate(&context->arena, Term, SITE_STREAM);
+  result->kind     = TERM_BUILT_IN;
+  result->built_in = index;
+  return result;
+}
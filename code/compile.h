@@ -0,0 +1,606 @@
+// The compiler translates a program into C that includes this interpreter.
+// Every top-level procedure whose body is a single expression built from
+// numbers, its parameters, "let", arithmetic, comparisons, "if", "cond",
+// "and", "or", "not", and calls to procedures compiled the same way becomes a
+// C function working on unboxed values. The program text is embedded and
+// evaluated as usual, and when a compiled procedure is defined its C function
+// is attached to it, so output is the same as running the interpreter.
+//
+// A procedure sees the globals that existed when it was defined, so each name
+// in a body is resolved against the definitions made by the forms before it.
+// Names that were not defined yet are looked up when the procedure runs,
+// which compiled code cannot do, so such bodies are left to the interpreter.
+
+typedef enum {
+  GLOBAL_PROCEDURE,
+  GLOBAL_CONSTANT,
+  GLOBAL_OTHER,
+} GlobalKind;
+
+typedef struct {
+  String     name;
+  GlobalKind kind;
+  U64        form;
+  Term*      parameters;
+  Term*      body;
+  Term*      constant;
+  B32        compiled;
+  U64        visible;
+} Global;
+
+typedef struct Local Local;
+
+struct Local {
+  String name;
+  U64    id;
+  Local* next;
+};
+
+typedef struct {
+  Context* context;
+  Output*  output;
+  Global*  globals;
+  U64      global_count;
+  U64      visible;
+  U64      next_id;
+} Compiler;
+
+static void emit(Compiler* compiler, String text) {
+  print(compiler->output, text);
+}
+
+static void emit_int(Compiler* compiler, I64 n) {
+  print_int(compiler->output, n);
+}
+
+static void emit_hex(Compiler* compiler, U64 n) {
+  U8 digits[16];
+  for (U64 i = 0; i < 16; i++) {
+    digits[15 - i] = "0123456789abcdef"[n & 15];
+    n >>= 4;
+  }
+  emit(compiler, string("0x"));
+  print(compiler->output, (String) { .data = digits, .size = 16 });
+}
+
+static void emit_name(Compiler* compiler, Global* global) {
+  emit(compiler, string("p"));
+  emit_int(compiler, global->form);
+  print_char(compiler->output, '_');
+  for (U64 i = 0; i < global->name.size; i++) {
+    U8 c = global->name.data[i];
+    B32 plain = ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || is_digit(c);
+    print_char(compiler->output, plain ? c : '_');
+  }
+}
+
+static Local* find_local(Local* locals, String name) {
+  for (Local* i = locals; i != NULL; i = i->next) {
+    if (strings_equal(i->name, name)) {
+      return i;
+    }
+  }
+  return NULL;
+}
+
+static Global* find_global(Compiler* compiler, String name) {
+  for (U64 i = compiler->visible; i > 0; i--) {
+    if (strings_equal(compiler->globals[i - 1].name, name)) {
+      return &compiler->globals[i - 1];
+    }
+  }
+  return NULL;
+}
+
+static BuiltInFn find_built_in_function(String name) {
+  for (U64 i = 0; i < length(built_ins); i++) {
+    if (strings_equal(built_in_names[i], name)) {
+      return built_ins[i];
+    }
+  }
+  return NULL;
+}
+
+static B32 is_compilable(Compiler* compiler, Local* locals, Term* term);
+
+static B32 are_compilable(Compiler* compiler, Local* locals, Term* list) {
+  for (Term* i = list; i->list.head && i->list.tail; i = i->list.tail) {
+    if (!is_compilable(compiler, locals, i->list.head)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static B32 is_compilable(Compiler* compiler, Local* locals, Term* term) {
+  if (term == NULL) {
+    return false;
+  }
+
+  switch (term->kind) {
+
+  case TERM_INTEGER:
+  case TERM_NUMBER:
+    return true;
+
+  case TERM_ATOM: {
+    if (find_local(locals, term->atom) != NULL) {
+      return true;
+    }
+    Global* global = find_global(compiler, term->atom);
+    return global != NULL && global->kind == GLOBAL_CONSTANT;
+  }
+
+  case TERM_LIST: {
+    if (is_nil_term(term) || term->list.head->kind != TERM_ATOM) {
+      return false;
+    }
+    String name     = term->list.head->atom;
+    Term*  operands = term->list.tail;
+    U64    count    = list_length(operands);
+
+    if (strings_equal(name, string("let"))) {
+      if (count != 2) {
+	return false;
+      }
+      Local* scope = locals;
+      for (Term* i = operands->list.head; i->list.head && i->list.tail; i = i->list.tail) {
+	Term* binding = i->list.head;
+	if (binding->kind != TERM_LIST || list_length(binding) != 2 ||
+	    binding->list.head->kind != TERM_ATOM ||
+	    !is_compilable(compiler, locals, binding->list.tail->list.head)) {
+	  return false;
+	}
+	Local* new = arena_allocate(&compiler->context->arena, Local, SITE_OTHER);
+	new->name  = binding->list.head->atom;
+	new->id    = 0;
+	new->next  = scope;
+	scope      = new;
+      }
+      return is_compilable(compiler, scope, operands->list.tail->list.head);
+    }
+
+    if (find_local(locals, name) != NULL) {
+      return false;
+    }
+    Global* global = find_global(compiler, name);
+    if (global != NULL) {
+      return global->kind == GLOBAL_PROCEDURE && global->compiled
+	&& list_length(global->parameters) == count
+	&& are_compilable(compiler, locals, operands);
+    }
+
+    BuiltInFn function = find_built_in_function(name);
+    if (function == built_in_add || function == built_in_multiply) {
+      return are_compilable(compiler, locals, operands);
+    } else if (function == built_in_subtract) {
+      return count >= 1 && are_compilable(compiler, locals, operands);
+    } else if (function == built_in_divide || function == built_in_and) {
+      return count >= 1 + (function == built_in_divide) && are_compilable(compiler, locals, operands);
+    } else if (function == built_in_less_than || function == built_in_equal ||
+	       function == built_in_greater_than || function == built_in_remainder) {
+      return count == 2 && are_compilable(compiler, locals, operands);
+    } else if (function == built_in_not || function == built_in_random || function == built_in_sin ||
+	       function == built_in_cos || function == built_in_log) {
+      return count == 1 && are_compilable(compiler, locals, operands);
+    } else if (function == built_in_if) {
+      return (count == 2 || count == 3) && are_compilable(compiler, locals, operands);
+    } else if (function == built_in_or) {
+      return are_compilable(compiler, locals, operands);
+    } else if (function == built_in_cond) {
+      for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+	Term* clause = i->list.head;
+	if (clause->kind != TERM_LIST || list_length(clause) != 2 ||
+	    !are_compilable(compiler, locals, clause)) {
+	  return false;
+	}
+      }
+      return true;
+    }
+    return false;
+  }
+
+  default:
+    return false;
+  }
+}
+
+static void emit_expression(Compiler* compiler, Local* locals, Term* term);
+
+static U64 emit_temporary(Compiler* compiler, Local* locals, Term* term) {
+  U64 id = compiler->next_id++;
+  emit(compiler, string("Native v"));
+  emit_int(compiler, id);
+  emit(compiler, string(" = "));
+  emit_expression(compiler, locals, term);
+  emit(compiler, string("; "));
+  return id;
+}
+
+static void emit_variable(Compiler* compiler, U64 id) {
+  emit(compiler, string("v"));
+  emit_int(compiler, id);
+}
+
+// Operands are evaluated left to right into temporaries, as the interpreter
+// does, and then combined pairwise starting from "first".
+static void emit_fold(Compiler* compiler, Local* locals, Term* operands, String operation, Term* first) {
+  emit(compiler, string("({ "));
+  U64 result = compiler->next_id++;
+  emit(compiler, string("Native v"));
+  emit_int(compiler, result);
+  emit(compiler, string(" = "));
+  if (first != NULL) {
+    emit_expression(compiler, locals, first);
+  } else {
+    emit_expression(compiler, locals, operands->list.head);
+    operands = operands->list.tail;
+  }
+  emit(compiler, string("; "));
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    emit_variable(compiler, result);
+    emit(compiler, string(" = "));
+    emit(compiler, operation);
+    emit(compiler, string("("));
+    emit_variable(compiler, result);
+    emit(compiler, string(", "));
+    emit_expression(compiler, locals, i->list.head);
+    emit(compiler, string("); "));
+  }
+  emit_variable(compiler, result);
+  emit(compiler, string("; })"));
+}
+
+static void emit_call(Compiler* compiler, Local* locals, Term* operands, String function, B32 with_context) {
+  emit(compiler, string("({ "));
+  U64 ids[NATIVE_ARGUMENTS];
+  U64 count = 0;
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    ids[count++] = emit_temporary(compiler, locals, i->list.head);
+  }
+  emit(compiler, function);
+  emit(compiler, string("("));
+  if (with_context) {
+    emit(compiler, string("context"));
+  }
+  for (U64 i = 0; i < count; i++) {
+    if (i > 0 || with_context) {
+      emit(compiler, string(", "));
+    }
+    emit_variable(compiler, ids[i]);
+  }
+  emit(compiler, string("); })"));
+}
+
+static void emit_conditional(Compiler* compiler, Local* locals, Term* operands, B32 conjunction) {
+  emit(compiler, string("({ "));
+  U64 result = compiler->next_id++;
+  emit(compiler, string("Native v"));
+  emit_int(compiler, result);
+  emit(compiler, string(" = native_truth("));
+  emit(compiler, conjunction ? string("true") : string("false"));
+  emit(compiler, string("); "));
+  U64 depth = 0;
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    emit_variable(compiler, result);
+    emit(compiler, string(" = "));
+    emit_expression(compiler, locals, i->list.head);
+    emit(compiler, string("; "));
+    if (!is_nil_term(i->list.tail)) {
+      emit(compiler, conjunction ? string("if (native_true(") : string("if (!native_true("));
+      emit_variable(compiler, result);
+      emit(compiler, string(")) { "));
+      depth++;
+    }
+  }
+  for (U64 i = 0; i < depth; i++) {
+    emit(compiler, string("} "));
+  }
+  emit_variable(compiler, result);
+  emit(compiler, string("; })"));
+}
+
+static void emit_expression(Compiler* compiler, Local* locals, Term* term) {
+  if (term->kind == TERM_INTEGER) {
+    emit(compiler, string("native_integer("));
+    emit_int(compiler, term->integer);
+    emit(compiler, string("ll)"));
+    return;
+  }
+  if (term->kind == TERM_NUMBER) {
+    U64 bits;
+    memcpy(&bits, &term->number, sizeof bits);
+    emit(compiler, string("native_bits("));
+    emit_hex(compiler, bits);
+    emit(compiler, string("ull)"));
+    return;
+  }
+  if (term->kind == TERM_ATOM) {
+    Local* local = find_local(locals, term->atom);
+    if (local != NULL) {
+      emit_variable(compiler, local->id);
+    } else {
+      emit_expression(compiler, locals, find_global(compiler, term->atom)->constant);
+    }
+    return;
+  }
+
+  String name     = term->list.head->atom;
+  Term*  operands = term->list.tail;
+
+  if (strings_equal(name, string("let"))) {
+    emit(compiler, string("({ "));
+    Local* scope = locals;
+    for (Term* i = operands->list.head; i->list.head && i->list.tail; i = i->list.tail) {
+      Term*  binding = i->list.head;
+      Local* new     = arena_allocate(&compiler->context->arena, Local, SITE_OTHER);
+      new->name      = binding->list.head->atom;
+      new->id        = emit_temporary(compiler, locals, binding->list.tail->list.head);
+      new->next      = scope;
+      scope          = new;
+    }
+    emit_expression(compiler, scope, operands->list.tail->list.head);
+    emit(compiler, string("; })"));
+    return;
+  }
+
+  Global* global = find_global(compiler, name);
+  if (global != NULL) {
+    emit(compiler, string("({ "));
+    U64 ids[NATIVE_ARGUMENTS];
+    U64 count = 0;
+    for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+      ids[count++] = emit_temporary(compiler, locals, i->list.head);
+    }
+    emit_name(compiler, global);
+    emit(compiler, string("(context"));
+    for (U64 i = 0; i < count; i++) {
+      emit(compiler, string(", "));
+      emit_variable(compiler, ids[i]);
+    }
+    emit(compiler, string("); })"));
+    return;
+  }
+
+  Term zero = { .kind = TERM_INTEGER, .integer = 0 };
+  Term one  = { .kind = TERM_INTEGER, .integer = 1 };
+
+  BuiltInFn function = find_built_in_function(name);
+  if (function == built_in_add) {
+    emit_fold(compiler, locals, operands, string("native_add"), &zero);
+  } else if (function == built_in_multiply) {
+    emit_fold(compiler, locals, operands, string("native_multiply"), &one);
+  } else if (function == built_in_subtract && is_nil_term(operands->list.tail)) {
+    emit_call(compiler, locals, operands, string("native_negate"), false);
+  } else if (function == built_in_subtract) {
+    emit_fold(compiler, locals, operands, string("native_subtract"), NULL);
+  } else if (function == built_in_divide) {
+    emit_fold(compiler, locals, operands, string("native_divide"), NULL);
+  } else if (function == built_in_less_than) {
+    emit_call(compiler, locals, operands, string("native_less_than"), false);
+  } else if (function == built_in_equal) {
+    emit_call(compiler, locals, operands, string("native_equal"), false);
+  } else if (function == built_in_greater_than) {
+    emit_call(compiler, locals, operands, string("native_greater_than"), false);
+  } else if (function == built_in_remainder) {
+    emit_call(compiler, locals, operands, string("native_remainder"), false);
+  } else if (function == built_in_not) {
+    emit_call(compiler, locals, operands, string("native_not"), false);
+  } else if (function == built_in_random) {
+    emit_call(compiler, locals, operands, string("native_random"), true);
+  } else if (function == built_in_sin) {
+    emit_call(compiler, locals, operands, string("native_sin"), false);
+  } else if (function == built_in_cos) {
+    emit_call(compiler, locals, operands, string("native_cos"), false);
+  } else if (function == built_in_log) {
+    emit_call(compiler, locals, operands, string("native_log"), false);
+  } else if (function == built_in_and) {
+    emit_conditional(compiler, locals, operands, true);
+  } else if (function == built_in_or) {
+    emit_conditional(compiler, locals, operands, false);
+  } else if (function == built_in_if) {
+    emit(compiler, string("(native_true("));
+    emit_expression(compiler, locals, operands->list.head);
+    emit(compiler, string(") ? "));
+    emit_expression(compiler, locals, operands->list.tail->list.head);
+    emit(compiler, string(" : "));
+    Term* otherwise = operands->list.tail->list.tail;
+    if (is_nil_term(otherwise)) {
+      emit(compiler, string("native_truth(false)"));
+    } else {
+      emit_expression(compiler, locals, otherwise->list.head);
+    }
+    emit(compiler, string(")"));
+  } else if (function == built_in_cond) {
+    emit(compiler, string("("));
+    for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+      Term* clause = i->list.head;
+      emit(compiler, string("native_true("));
+      emit_expression(compiler, locals, clause->list.head);
+      emit(compiler, string(") ? "));
+      emit_expression(compiler, locals, clause->list.tail->list.head);
+      emit(compiler, string(" : "));
+    }
+    emit(compiler, string("native_truth(false))"));
+  }
+}
+
+static void emit_signature(Compiler* compiler, Global* global) {
+  emit(compiler, string("static Native "));
+  emit_name(compiler, global);
+  emit(compiler, string("(Context* context"));
+  U64 index = 0;
+  for (Term* i = global->parameters; i->list.head && i->list.tail; i = i->list.tail) {
+    emit(compiler, string(", Native v"));
+    emit_int(compiler, index++);
+  }
+  emit(compiler, string(")"));
+}
+
+static void emit_source(Compiler* compiler, String source) {
+  emit(compiler, string("static const char source[] =\n  \""));
+  for (U64 i = 0; i < source.size; i++) {
+    U8 c = source.data[i];
+    if (c == '\n') {
+      emit(compiler, i + 1 < source.size ? string("\\n\"\n  \"") : string("\\n"));
+    } else if (c == '"' || c == '\\') {
+      print_char(compiler->output, '\\');
+      print_char(compiler->output, c);
+    } else if (c < ' ' || c >= 127) {
+      print_char(compiler->output, '\\');
+      print_char(compiler->output, '0' + (c >> 6));
+      print_char(compiler->output, '0' + ((c >> 3) & 7));
+      print_char(compiler->output, '0' + (c & 7));
+    } else {
+      print_char(compiler->output, c);
+    }
+  }
+  emit(compiler, string("\";\n\n"));
+}
+
+static void emit_program(Context* context, String source) {
+  Compiler compiler;
+  compiler.context      = context;
+  compiler.output       = &context->output;
+  compiler.global_count = 0;
+  compiler.next_id      = 0;
+
+  U64   forms = 0;
+  Term* first = NULL;
+  for (String input = clear_blanks(source); input.size > 0; input = clear_blanks(input)) {
+    ParseResult parsed = parse(&context->arena, input);
+    input              = parsed.rest;
+    Term* new          = arena_allocate(&context->arena, Term, SITE_OTHER);
+    new->kind          = TERM_LIST;
+    new->list.head     = parsed.term;
+    new->list.tail     = first;
+    first              = new;
+    forms++;
+  }
+
+  // The forms were collected in reverse; globals are numbered in order.
+  Term** program = (Term**) arena_allocate_bytes(&context->arena, forms * sizeof(Term*), _Alignof(Term*), SITE_OTHER);
+  for (U64 i = forms; i > 0; i--) {
+    program[i - 1] = first->list.head;
+    first          = first->list.tail;
+  }
+  compiler.globals = (Global*) arena_allocate_bytes(&context->arena, forms * sizeof(Global), _Alignof(Global), SITE_OTHER);
+
+  for (U64 form = 0; form < forms; form++) {
+    Term* term = program[form];
+    if (term == NULL || term->kind != TERM_LIST || is_nil_term(term) ||
+	!is_atom_named(term->list.head, string("define")) || is_nil_term(term->list.tail)) {
+      continue;
+    }
+    Term*   header = term->list.tail->list.head;
+    Term*   rest   = term->list.tail->list.tail;
+    Global* global = &compiler.globals[compiler.global_count++];
+    global->form     = form;
+    global->compiled = false;
+    global->visible  = compiler.global_count;
+
+    if (header->kind == TERM_LIST && !is_nil_term(header) && header->list.head->kind == TERM_ATOM) {
+      global->name       = header->list.head->atom;
+      global->kind       = GLOBAL_PROCEDURE;
+      global->parameters = header->list.tail;
+      global->body       = rest;
+
+      Local* locals = NULL;
+      U64    count  = 0;
+      for (Term* i = header->list.tail; i->list.head && i->list.tail; i = i->list.tail) {
+	Local* new = arena_allocate(&context->arena, Local, SITE_OTHER);
+	new->name  = i->list.head->atom;
+	new->id    = count++;
+	new->next  = locals;
+	locals     = new;
+      }
+
+      // Recursive calls are compiled on the assumption that the body is.
+      compiler.visible = compiler.global_count;
+      global->compiled = true;
+      global->compiled = count <= NATIVE_ARGUMENTS && list_length(rest) == 1
+	&& is_compilable(&compiler, locals, rest->list.head);
+    } else if (header->kind == TERM_ATOM) {
+      global->name     = header->atom;
+      global->constant = is_nil_term(rest) ? NULL : rest->list.head;
+      global->kind     = is_numeric_term(global->constant) && is_nil_term(rest->list.tail)
+	? GLOBAL_CONSTANT
+	: GLOBAL_OTHER;
+    } else {
+      compiler.global_count--;
+    }
+  }
+
+  emit(&compiler, string(
+    "// Generated by vlisp --emit-c. Build with:\n"
+    "//   gcc -O2 -I path/to/vlisp/code program.c -lm -pthread -o program\n\n"
+    "#define VLISP_PROGRAM\n"
+    "#include \"main.c\"\n\n"
+  ));
+
+  for (U64 i = 0; i < compiler.global_count; i++) {
+    Global* global = &compiler.globals[i];
+    if (global->kind == GLOBAL_PROCEDURE && global->compiled) {
+      emit_signature(&compiler, global);
+      emit(&compiler, string(";\n"));
+    }
+  }
+  emit(&compiler, string("\n"));
+
+  for (U64 i = 0; i < compiler.global_count; i++) {
+    Global* global = &compiler.globals[i];
+    if (global->kind != GLOBAL_PROCEDURE || !global->compiled) {
+      continue;
+    }
+    compiler.visible = global->visible;
+
+    Local* locals = NULL;
+    U64    count  = 0;
+    for (Term* j = global->parameters; j->list.head && j->list.tail; j = j->list.tail) {
+      Local* new = arena_allocate(&context->arena, Local, SITE_OTHER);
+      new->name  = j->list.head->atom;
+      new->id    = count++;
+      new->next  = locals;
+      locals     = new;
+    }
+    compiler.next_id = count;
+
+    emit_signature(&compiler, global);
+    emit(&compiler, string(" {\n  native_step(context);\n  return "));
+    emit_expression(&compiler, locals, global->body->list.head);
+    emit(&compiler, string(";\n}\n\nstatic Native "));
+    emit_name(&compiler, global);
+    emit(&compiler, string("_entry(Context* context, Native* arguments) {\n  return "));
+    emit_name(&compiler, global);
+    emit(&compiler, string("(context"));
+    for (U64 j = 0; j < count; j++) {
+      emit(&compiler, string(", arguments["));
+      emit_int(&compiler, j);
+      emit(&compiler, string("]"));
+    }
+    emit(&compiler, string(");\n}\n\n"));
+  }
+
+  emit(&compiler, string("static NativeFn natives["));
+  emit_int(&compiler, forms > 0 ? forms : 1);
+  emit(&compiler, string("] = {\n"));
+  for (U64 i = 0; i < compiler.global_count; i++) {
+    Global* global = &compiler.globals[i];
+    if (global->kind == GLOBAL_PROCEDURE && global->compiled) {
+      emit(&compiler, string("  ["));
+      emit_int(&compiler, global->form);
+      emit(&compiler, string("] = "));
+      emit_name(&compiler, global);
+      emit(&compiler, string("_entry,\n"));
+    }
+  }
+  emit(&compiler, string("};\n\n"));
+
+  emit_source(&compiler, source);
+  emit(&compiler, string(
+    "int main(int argc, char** argv) {\n"
+    "  String program = { .data = (U8*) source, .size = sizeof source - 1 };\n"
+    "  return run_compiled(natives, length(natives), program, argc, argv);\n"
+    "}\n"
+  ));
+}
@@ -0,0 +1,157 @@
+// A governor stops a program that runs longer, allocates more or recurses
+// deeper than it was allowed to, printing what it had used so far. Limits
+// left at 0 are not enforced.
+//
+// Steps are evaluations of a term and calls of a procedure compiled by
+// --emit-c. The operands of arithmetic are evaluated on unboxed numbers, and
+// those that are numbers, names or arithmetic themselves are not counted, so a
+// whole arithmetic expression may be one step. Each step only decrements
+// "fuel"; the limits on steps and time are checked when it runs out, every
+// GOVERNOR_SLICE steps. The memory limit lowers the arena's "limit", so it is
+// only checked when the arena commits more memory, and the depth limit is
+// checked when a call goes deeper than any call before it. So is the room left
+// on the evaluation stack: whatever the limits, a governed program is stopped
+// before its calls run off the end of it.
+
+#define GOVERNOR_SLICE        4096
+#define GOVERNOR_STACK_MARGIN (256ull << 10)
+
+typedef enum {
+  LIMIT_STEPS,
+  LIMIT_MEMORY,
+  LIMIT_DEPTH,
+  LIMIT_TIME,
+  LIMIT_STACK,
+} LimitKind;
+
+struct Governor {
+  Context* context;
+
+  U64 steps;
+  U64 memory;
+  U64 depth;
+  U64 milliseconds;
+
+  // Steps handed out so far, of which "fuel" are not taken yet.
+  U64 granted;
+  U64 fuel;
+  U64 calls;
+  U64 deepest;
+  U64 base;
+  U64 started;
+  U64 deadline;
+};
+
+static U64 governor_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static Governor* governor_create(Context* context, U64 steps, U64 memory, U64 depth, U64 milliseconds) {
+  Governor* governor = mmap(NULL, sizeof(Governor), PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(governor != MAP_FAILED);
+  governor->context      = context;
+  governor->steps        = steps;
+  governor->memory       = memory;
+  governor->depth        = depth;
+  governor->milliseconds = milliseconds;
+  return governor;
+}
+
+static void governor_refuel(Governor* governor) {
+  U64 fuel = GOVERNOR_SLICE;
+  if (governor->steps != 0 && governor->steps - governor->granted < fuel) {
+    fuel = governor->steps - governor->granted;
+  }
+  governor->granted += fuel;
+  governor->fuel     = fuel;
+}
+
+// Starts counting against the limits afresh, as each program run or served
+// request does. Memory counts from what the arena holds now, and memory
+// committed beyond the new limit is handed back so the limit is seen.
+static void governor_start(Governor* governor) {
+  Arena* arena = &governor->context->arena;
+
+  governor->granted  = 0;
+  governor->calls    = 0;
+  governor->deepest  = 0;
+  governor->base     = arena->used;
+  governor->started  = governor_now();
+  governor->deadline = governor->started + governor->milliseconds * 1000000;
+  governor_refuel(governor);
+
+  arena->limit = arena->capacity;
+  if (governor->memory != 0 && governor->memory < arena->capacity - arena->used) {
+    arena->limit = (arena->used + governor->memory) & ~(ARENA_PAGE - 1);
+  }
+  U64 keep = (arena->used + ARENA_PAGE - 1) & ~(ARENA_PAGE - 1);
+  if (arena->limit < keep) {
+    arena->limit = keep;
+  }
+  if (arena->committed > arena->limit) {
+    assert(mprotect(&arena->memory[keep], arena->committed - keep, PROT_NONE) == 0);
+    madvise(&arena->memory[keep], arena->committed - keep, MADV_DONTNEED);
+    arena->committed = keep;
+  }
+}
+
+static void print_limit(Output* output, String name, U64 used, U64 limit) {
+  print(output, name);
+  print_int(output, used);
+  if (limit != 0) {
+    print(output, string(" of "));
+    print_int(output, limit);
+  }
+}
+
+static void governor_stop(Governor* governor, LimitKind kind) {
+  Arena*  arena  = &governor->context->arena;
+  Output* output = &governor->context->output;
+  U64     steps  = governor->granted - governor->fuel;
+  U64     bytes  = arena->used - governor->base;
+  U64     time   = (governor_now() - governor->started) / 1000000;
+
+  static const char* names[] = { "step", "memory", "depth", "time", "stack" };
+  print(output, string("Stopped by the "));
+  print(output, string(names[kind]));
+  print(output, string(" limit after "));
+  print_limit(output, string("steps "), steps, governor->steps);
+  print_limit(output, string(", bytes "), bytes, governor->memory);
+  print_limit(output, string(", depth "), governor->deepest, governor->depth);
+  print_limit(output, string(", milliseconds "), time, governor->milliseconds);
+  print(output, string(".\n"));
+
+  // Leaves room for whatever runs after an embedding resumes.
+  arena->limit = arena->capacity;
+  fail(governor->context);
+}
+
+static void governor_tick(Governor* governor) {
+  if (governor->steps != 0 && governor->granted >= governor->steps) {
+    governor_stop(governor, LIMIT_STEPS);
+  }
+  if (governor->milliseconds != 0 && governor_now() >= governor->deadline) {
+    governor_stop(governor, LIMIT_TIME);
+  }
+  governor_refuel(governor);
+}
+
+static void governor_deeper(Governor* governor) {
+  governor->deepest = governor->calls;
+  if (governor->depth != 0 && governor->calls > governor->depth) {
+    governor_stop(governor, LIMIT_DEPTH);
+  }
+  EvaluationStack* stack = &governor->context->stack;
+  U8*              frame = __builtin_frame_address(0);
+  if (stack->running && (U64) (frame - stack->memory) < GOVERNOR_STACK_MARGIN) {
+    governor_stop(governor, LIMIT_STACK);
+  }
+}
+
+static void arena_exhausted(Arena* arena) {
+  assert(arena->governor != NULL && arena->limit < arena->capacity);
+  governor_stop(arena->governor, LIMIT_MEMORY);
+}
@@ -0,0 +1,192 @@
+// Vectors can be read from files without reading all of the file first. A
+// file of little-endian 64-bit numbers is mapped and used as the vector's
+// array as it is. A CSV file is mapped too, but only its newlines are found
+// when a column of it is read: the rows are split into chunks of
+// INGEST_CHUNK, and a chunk is parsed the first time one of its elements is
+// used. Whatever uses the whole vector parses the chunks still left all at
+// once, on a thread per CPU.
+//
+// Neither kind of vector keeps its elements in the arena, so one can be
+// larger than the arena. Their mappings are made with arena_map, and go when
+// the vector's memory is released.
+
+#define INGEST_CHUNK   65536
+#define INGEST_THREADS 64
+#define INGEST_FIELD   64
+
+struct VectorSource {
+  Vector* vector;
+  U8*     text;
+  U64     size;
+  U64     column;
+  U64     chunks;
+  U64     remaining;
+  // Where each chunk's first row starts, and where the last one ends.
+  U64*    starts;
+  B32*    parsed;
+  // The next chunk for a thread to parse.
+  U64     next;
+};
+
+// A file of "count" elements of "kind", shared with the page cache until an
+// element is set.
+static Vector* vector_map_binary(Arena* arena, int fd, TermKind kind) {
+  struct stat info;
+  assert(fstat(fd, &info) == 0);
+  U64 count = info.st_size / 8;
+  if (count == 0) {
+    return vector_create(arena, kind, 0);
+  }
+  F64*    numbers = (F64*) arena_map(arena, fd, info.st_size, PROT_READ | PROT_WRITE);
+  Vector* vector  = arena_allocate(arena, Vector, SITE_VECTOR);
+  vector->kind    = kind;
+  vector->count   = count;
+  vector->source  = NULL;
+  vector->numbers = numbers;
+  return vector;
+}
+
+// A field that is empty or not a number is NaN. strtod needs a terminated
+// string, and the field is followed by the rest of the file, so it is copied.
+static F64 parse_field(U8* start, U8* end) {
+  char buffer[INGEST_FIELD];
+  while (start < end && (*start == ' ' || *start == '"')) {
+    start++;
+  }
+  U64 size = end - start < INGEST_FIELD - 1 ? end - start : INGEST_FIELD - 1;
+  memcpy(buffer, start, size);
+  buffer[size] = 0;
+
+  char* rest;
+  F64   number = strtod(buffer, &rest);
+  return rest == buffer ? NAN : number;
+}
+
+static void ingest_chunk(VectorSource* source, U64 chunk) {
+  U8*  row = &source->text[source->starts[chunk]];
+  U8*  end = &source->text[source->starts[chunk + 1]];
+  F64* out = &source->vector->numbers[chunk * INGEST_CHUNK];
+  for (; row < end; out++) {
+    U8* line_end = memchr(row, '\n', end - row);
+    if (line_end == NULL) {
+      line_end = end;
+    }
+    U8* field = row;
+    for (U64 i = 0; i < source->column && field != NULL; i++) {
+      field = memchr(field, ',', line_end - field);
+      field = field != NULL ? field + 1 : NULL;
+    }
+    if (field == NULL) {
+      *out = NAN;
+    } else {
+      U8* field_end = memchr(field, ',', line_end - field);
+      *out          = parse_field(field, field_end != NULL ? field_end : line_end);
+    }
+    row = line_end + 1;
+  }
+  source->parsed[chunk] = true;
+}
+
+// Column "column", counting from 0, of every row after the first "skip", as
+// floats.
+static Vector* vector_map_csv(Arena* arena, int fd, U64 column, U64 skip) {
+  struct stat info;
+  assert(fstat(fd, &info) == 0);
+  if (info.st_size == 0) {
+    return vector_create(arena, TERM_NUMBER, 0);
+  }
+  U8* text = arena_map(arena, fd, info.st_size, PROT_READ);
+  U8* end  = text + info.st_size;
+  madvise(text, info.st_size, MADV_SEQUENTIAL);
+
+  // Every chunk but the last has INGEST_CHUNK rows of at least a byte each.
+  VectorSource* source = arena_allocate(arena, VectorSource, SITE_VECTOR);
+  U64           most   = info.st_size / INGEST_CHUNK + 2;
+  source->text   = text;
+  source->size   = info.st_size;
+  source->column = column;
+  source->chunks = 0;
+  source->starts = (U64*) arena_allocate_bytes(arena, most * sizeof(U64), _Alignof(U64), SITE_VECTOR);
+  source->parsed = (B32*) arena_allocate_bytes(arena, most * sizeof(B32), _Alignof(B32), SITE_VECTOR);
+
+  U8* row = text;
+  for (U64 i = 0; i < skip && row < end; i++) {
+    U8* line_end = memchr(row, '\n', end - row);
+    row          = line_end != NULL ? line_end + 1 : end;
+  }
+  U64 count = 0;
+  while (row < end) {
+    if (count % INGEST_CHUNK == 0) {
+      source->parsed[source->chunks]   = false;
+      source->starts[source->chunks++] = row - text;
+    }
+    U8* line_end = memchr(row, '\n', end - row);
+    row          = line_end != NULL ? line_end + 1 : end;
+    count++;
+  }
+  source->starts[source->chunks] = info.st_size;
+  source->remaining              = source->chunks;
+  madvise(text, info.st_size, MADV_RANDOM);
+
+  Vector* vector = arena_allocate(arena, Vector, SITE_VECTOR);
+  vector->kind   = TERM_NUMBER;
+  vector->count  = count;
+  vector->source = count > 0 ? source : NULL;
+  source->vector = vector;
+  if (count == 0) {
+    vector->numbers = NULL;
+    return vector;
+  }
+  vector->numbers = (F64*) arena_map(arena, -1, count * sizeof(F64), PROT_READ | PROT_WRITE);
+  return vector;
+}
+
+// Parses the chunk holding element "index" if it has not been.
+static void vector_touch(Vector* vector, U64 index) {
+  VectorSource* source = vector->source;
+  if (source == NULL || source->parsed[index / INGEST_CHUNK]) {
+    return;
+  }
+  ingest_chunk(source, index / INGEST_CHUNK);
+  if (--source->remaining == 0) {
+    vector->source = NULL;
+  }
+}
+
+static void* ingest_worker(void* argument) {
+  VectorSource* source = argument;
+  U64           chunk;
+  while ((chunk = __atomic_fetch_add(&source->next, 1, __ATOMIC_RELAXED)) < source->chunks) {
+    if (!source->parsed[chunk]) {
+      ingest_chunk(source, chunk);
+    }
+  }
+  return NULL;
+}
+
+// Parses every chunk that has not been.
+static void vector_materialize(Vector* vector) {
+  VectorSource* source = vector->source;
+  if (source == NULL) {
+    return;
+  }
+  I64 threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > (I64) source->remaining) {
+    threads = source->remaining;
+  }
+  if (threads > INGEST_THREADS) {
+    threads = INGEST_THREADS;
+  }
+
+  pthread_t workers[INGEST_THREADS];
+  source->next = 0;
+  for (I64 i = 1; i < threads; i++) {
+    assert(pthread_create(&workers[i], NULL, ingest_worker, source) == 0);
+  }
+  ingest_worker(source);
+  for (I64 i = 1; i < threads; i++) {
+    assert(pthread_join(workers[i], NULL) == 0);
+  }
+  source->remaining = 0;
+  vector->source    = NULL;
+}
@@ -1,16 +1,35 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <ucontext.h>
 #include <unistd.h>
 
+// Built as the vlisp command, rather than as the library for embedding or a
+// program compiled by --emit-c. Only the command has the options and modes
+// that main chooses between.
+#if !defined(VLISP_LIBRARY) && !defined(VLISP_PROGRAM)
+#define VLISP_COMMAND
+#endif
+
 #include "basic.h"
 #include "print.h"
+#include "profile.h"
 
+#ifdef VLISP_COMMAND
 static String read_file(char* path) {
   int fd = open(path, O_RDONLY);
   assert(fd != -1);
@@ -22,11 +41,55 @@ static String read_file(char* path) {
   U8* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
   return (String) { .data = data, .size = size };
 }
+#endif
+
+#define ARENA_CHUNK (1ull << 20)
+#define ARENA_PAGE  4096ull
+
+// The reservation is made readable and writable "chunk" bytes at a time.
+//
+// Memory below "pinned" may be referenced by something that outlives the
+// evaluation currently in progress, such as a procedure capturing its
+// environment. Anything that stores a pointer to new memory into an older
+// object must call arena_pin so those bytes are never released, or
+// arena_pin_object when only that one object is written. Memory from the
+// object to the newest allocation, "held_from" to "held_to" for all such
+// objects, then stays, but a mark taken before the object was allocated can
+// still be restored, since the object goes too.
+//
+// "dirty" is the highest offset written since memory was last handed back to
+// the system. Memory is never committed past "limit", which is the capacity
+// unless a governor lowers it. "allocated" counts every byte ever handed out,
+// including those handed back since.
+//
+// Files mapped for terms to point into are listed in "mappings", newest
+// first. Each entry is allocated in the arena right after its mapping is
+// made, so when arena_restore releases the entry the mapping is unmapped too.
+typedef struct Governor Governor;
+typedef struct ArenaMapping ArenaMapping;
+
+struct ArenaMapping {
+  U8*           data;
+  U64           size;
+  ArenaMapping* next;
+};
 
 typedef struct {
   U8* memory;
+  U64 capacity;
   U64 used;
   U64 committed;
+  U64 pinned;
+  U64 held_from;
+  U64 held_to;
+  U64 dirty;
+  U64 chunk;
+  U64 limit;
+  U64 allocated;
+
+  ArenaMapping* mappings;
+  Profile*      profile;
+  Governor*     governor;
 } Arena;
 
 static void arena_initialize(Arena* arena, U64 capacity) {
@@ -34,11 +97,33 @@ static void arena_initialize(Arena* arena, U64 capacity) {
   assert(memory != MAP_FAILED);
 
   arena->memory	   = memory;
+  arena->capacity  = capacity;
   arena->used	   = 0;
   arena->committed = 0;
+  arena->pinned	   = 0;
+  arena->held_from = 0;
+  arena->held_to   = 0;
+  arena->dirty	   = 0;
+  arena->chunk	   = ARENA_CHUNK;
+  arena->limit	   = capacity;
+  arena->allocated = 0;
+  arena->mappings  = NULL;
+  arena->profile   = NULL;
+  arena->governor  = NULL;
+}
+
+#ifdef VLISP_COMMAND
+static void arena_configure(Arena* arena, U64 chunk, B32 huge_pages) {
+  arena->chunk = (chunk + ARENA_PAGE - 1) & ~(ARENA_PAGE - 1);
+  if (huge_pages) {
+    madvise(arena->memory, arena->capacity, MADV_HUGEPAGE);
+  }
 }
+#endif
 
-static U8* arena_allocate_bytes(Arena* arena, U64 size, U64 alignment) {
+static void arena_exhausted(Arena* arena);
+
+static U8* arena_allocate_bytes(Arena* arena, U64 size, U64 alignment, AllocationSite site) {
   U8* memory	= arena->memory;
   U64 used	= arena->used;
   U64 committed = arena->committed;
@@ -49,18 +134,113 @@ static U8* arena_allocate_bytes(Arena* arena, U64 size, U64 alignment) {
   used   = used + size;
 
   if (used > committed) {
-    U64 new = (used - committed + 4095) & ~(4095);
+    U64 chunk = arena->chunk;
+    U64 new   = (used - committed + chunk - 1) / chunk * chunk;
+    if (new > arena->limit - committed) {
+      new = arena->limit - committed;
+    }
+    if (used - committed > new) {
+      arena_exhausted(arena);
+    }
     assert(mprotect(&memory[committed], new, PROT_READ | PROT_WRITE) == 0);
     committed += new;
   }
 
-  arena->used      = used;
-  arena->committed = committed;
+  arena->used       = used;
+  arena->committed  = committed;
+  arena->allocated += size;
+
+  if (arena->profile != NULL && size > 0) {
+    profile_record(arena->profile, site, size, used);
+  }
   return result;
 }
 
-#define arena_allocate(arena, type) \
-  ((type*) arena_allocate_bytes(arena, sizeof(type), _Alignof(type)))
+#define arena_allocate(arena, type, site) \
+  ((type*) arena_allocate_bytes(arena, sizeof(type), _Alignof(type), site))
+
+// Makes allocations count against "name" while profiling, and returns the
+// name they counted against before.
+static String profile_enter(Arena* arena, String name) {
+  if (arena->profile == NULL) {
+    return name;
+  }
+  String previous           = arena->profile->procedure;
+  arena->profile->procedure = name;
+  return previous;
+}
+
+static void arena_pin(Arena* arena) {
+  arena->pinned = arena->used;
+}
+
+// Only one range is tracked. When the object is newer than the current range,
+// that range is folded into "pinned", which holds at least as much.
+static void arena_pin_object(Arena* arena, void* object) {
+  U64 offset = (U8*) object - arena->memory;
+  if (arena->held_to != 0 && offset >= arena->held_to) {
+    if (arena->held_to > arena->pinned) {
+      arena->pinned = arena->held_to;
+    }
+    arena->held_to = 0;
+  }
+  if (arena->held_to == 0 || offset < arena->held_from) {
+    arena->held_from = offset;
+  }
+  arena->held_to = arena->used;
+}
+
+// Maps "size" bytes of "fd", or anonymous memory when "fd" is -1, for as long
+// as what is allocated from now on is kept.
+static U8* arena_map(Arena* arena, int fd, U64 size, int protection) {
+  int flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE : MAP_PRIVATE;
+  U8* data  = mmap(NULL, size, protection, flags, fd, 0);
+  assert(data != MAP_FAILED);
+  ArenaMapping* mapping = arena_allocate(arena, ArenaMapping, SITE_OTHER);
+  mapping->data         = data;
+  mapping->size         = size;
+  mapping->next         = arena->mappings;
+  arena->mappings       = mapping;
+  return data;
+}
+
+static void arena_unmap(Arena* arena, U64 mark) {
+  while (arena->mappings != NULL && (U8*) arena->mappings >= &arena->memory[mark]) {
+    munmap(arena->mappings->data, arena->mappings->size);
+    arena->mappings = arena->mappings->next;
+  }
+}
+
+static B32 arena_releasable(Arena* arena, U64 mark) {
+  return arena->pinned <= mark && !(arena->held_from < mark && mark < arena->held_to);
+}
+
+static U64 arena_mark(Arena* arena) {
+  return arena->used;
+}
+
+// Frees everything allocated since "mark". Pages stay committed, but once
+// more than a few chunks past the mark have been written they are returned
+// to the system, keeping one chunk warm for the allocations that follow.
+static void arena_restore(Arena* arena, U64 mark) {
+  assert(arena_releasable(arena, mark) && mark <= arena->used);
+  arena_unmap(arena, mark);
+  if (arena->used > arena->dirty) {
+    arena->dirty = arena->used;
+  }
+  arena->used = mark;
+  if (arena->held_from >= mark) {
+    arena->held_from = 0;
+    arena->held_to   = 0;
+  }
+
+  U64 chunk = arena->chunk;
+  U64 keep  = (mark + chunk - 1) / chunk * chunk + chunk;
+  if (arena->dirty > keep + 4 * chunk) {
+    madvise(&arena->memory[keep], arena->dirty - keep, MADV_DONTNEED);
+    arena->dirty = keep;
+  }
+}
 
 typedef struct Values Values;
 
@@ -72,6 +252,9 @@ typedef enum {
   TERM_LIST,
   TERM_BUILT_IN,
   TERM_PROCEDURE,
+  TERM_TABLE,
+  TERM_VECTOR,
+  TERM_PROMISE,
 } TermKind;
 
 typedef struct Term Term;
@@ -83,11 +266,31 @@ typedef struct {
 
 typedef String Atom;
 
+typedef struct Table Table;
+typedef struct Vector Vector;
+typedef struct VectorKernels VectorKernels;
+
+typedef struct VlispContext Context;
+typedef struct Native Native;
+typedef Native (*NativeFn)(Context* context, Native* arguments);
+
+// A promise evaluates "expression" in "values" the first time it is forced
+// and keeps the result in "value".
 typedef struct {
-  String  name;
-  Values* captured;
-  Term*   parameters;
-  Term*   body;
+  Term*   expression;
+  Values* values;
+  Term*   value;
+} Promise;
+
+// "native" is set for procedures compiled to C by --emit-c. It is called
+// instead of evaluating the body whenever every argument is a number.
+typedef struct {
+  String   name;
+  Values*  captured;
+  Term*    parameters;
+  Term*    body;
+  B32      escapes;
+  NativeFn native;
 } Procedure;
 
 struct Term {
@@ -100,94 +303,267 @@ struct Term {
     List      list;
     U64       built_in;
     Procedure procedure;
+    Table*    table;
+    Vector*   vector;
+    Promise*  promise;
   };
 };
 
-static Term term_nil = {
-  .kind = TERM_LIST,
-};
-
-static Term term_t = {
-  .kind = TERM_ATOM,
-  .atom = string("t"),
-};
-
 static B32 is_nil_term(Term* term) {
   return term->kind == TERM_LIST && term->list.head == NULL && term->list.tail == NULL;
 }
 
+#include "vector.h"
+#include "ingest.h"
+
 typedef struct {
   Term*   term;
   Values* values;
 } EvaluateResult;
 
-static void print_term(Term* term);
-static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input);
+// Calls run on the native stack until one is EVALUATION_NATIVE_DEPTH below
+// "base", where the top-level form started, and that call switches to a
+// stack of its own. It is reserved as large as the arena but only takes
+// memory as deep as calls have gone, so recursion is limited by memory, not
+// by the stack limit. "lowest" is the deepest call's frame on it. The call
+// to run is described by "procedure" and the fields after it and "output"
+// receives its value; an error while running sets "failed" and switches back.
+#define EVALUATION_NATIVE_DEPTH (128ull << 10)
+#define EVALUATION_STACK_SLACK  (256ull << 10)
 
+typedef struct {
+  U8*        memory;
+  U64        size;
+  U8*        base;
+  U8*        lowest;
+  B32        running;
+  B32        failed;
+  ucontext_t caller;
+  ucontext_t callee;
+
+  Procedure* procedure;
+  Values*    values;
+  Values*    arguments;
+  Values*    first;
+  B32        numeric;
+  Term*      output;
+} EvaluationStack;
+
+// Everything one interpreter owns. The context is the first allocation in its
+// own arena, so separate contexts share no mutable state and can run on
+// different threads.
+struct VlispContext {
+  Arena    arena;
+  Values*  values;
+  Output   output;
+  U64      random;
+  Term     nil;
+  Term     t;
+  jmp_buf* failure;
+  B32      quiet;
+
+  // What is left of standard input for "read", once it has been loaded.
+  String input;
+  B32    input_loaded;
+
+  NativeFn* natives;
+  U64       native_count;
+
+  const VectorKernels* kernels;
+
+  EvaluationStack stack;
+};
+
+static Context* context_create(U64 capacity, int fd, OutputFn sink, void* user) {
+  Arena arena;
+  arena_initialize(&arena, capacity);
+
+  Context* context = arena_allocate(&arena, Context, SITE_OTHER);
+  context->arena   = arena;
+  context->values  = NULL;
+  context->random  = 0x2545F4914F6CDD1Dull;
+  context->failure = NULL;
+  context->quiet   = false;
+  context->input_loaded = false;
+  context->natives      = NULL;
+  context->native_count = 0;
+  context->kernels      = vector_select_kernels();
+  context->stack.memory  = NULL;
+  context->stack.base    = NULL;
+  context->stack.running = false;
+  output_initialize(&context->output, fd, sink, user);
+
+  context->nil.kind      = TERM_LIST;
+  context->nil.list.head = NULL;
+  context->nil.list.tail = NULL;
+  context->t.kind        = TERM_ATOM;
+  context->t.atom        = string("t");
+  return context;
+}
+
+static void context_seed(Context* context, U64 seed) {
+  context->random = seed == 0 ? 0x2545F4914F6CDD1Dull : seed;
+}
+
+// An xorshift generator, scaled down to the 31 bits "rand" would return.
+static U64 context_random(Context* context) {
+  U64 x = context->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  context->random = x;
+  return (x * 0x2545F4914F6CDD1Dull) >> 33;
+}
+
+// Stops evaluation after an error has been printed. An embedding that set
+// "failure" resumes there; the command line exits.
+static void fail(Context* context) {
+  flush(&context->output);
+  if (context->arena.profile != NULL) {
+    profile_report(context->arena.profile, context->arena.used);
+    // The calls that were running never return to restore their callers.
+    context->arena.profile->procedure = profile_top_level;
+  }
+  if (context->failure != NULL && context->stack.running) {
+    // The jump is made from the native stack the evaluation started on.
+    context->stack.failed = true;
+    setcontext(&context->stack.caller);
+  }
+  if (context->failure != NULL) {
+    longjmp(*context->failure, 1);
+  }
+  exit(EXIT_FAILURE);
+}
+
+#include "governor.h"
+
+// Creating a promise pins nothing: only forcing it stores a newer value in it.
+static Term* make_promise(Arena* arena, Values* values, Term* expression) {
+  Promise* promise    = arena_allocate(arena, Promise, SITE_STREAM);
+  promise->expression = expression;
+  promise->values     = values;
+  promise->value      = NULL;
+
+  Term* term    = arena_allocate(arena, Term, SITE_STREAM);
+  term->kind    = TERM_PROMISE;
+  term->promise = promise;
+  return term;
+}
+
+typedef struct {
+  Term*  term;
+  String rest;
+} ParseResult;
+
+static String read_all(Arena* arena, int fd) {
+  String result = { .data = arena_allocate_bytes(arena, 0, 1, SITE_OTHER), .size = 0 };
+  while (true) {
+    U8* chunk = arena_allocate_bytes(arena, 65536, 1, SITE_OTHER);
+    I64 count = read(fd, chunk, 65536);
+    assert(count >= 0);
+    result.size += count;
+    arena->used -= 65536 - count;
+    if (count == 0) {
+      return result;
+    }
+  }
+}
+
+static void print_term(Output* output, Term* term);
+static EvaluateResult evaluate_term(Context* context, Values* values, Term* input);
+static Term* apply(Context* context, Values* values, Term* function, Term** arguments, U64 count);
+static String clear_blanks(String input);
+static ParseResult parse(Arena* arena, String input);
+
+#include "table.h"
 #include "built_in.h"
 
-static void print_term(Term* term) {
+static void print_term(Output* output, Term* term) {
   switch (term->kind) {
 
   case TERM_ATOM:
-    print(term->atom);
+    print(output, term->atom);
     break;
 
   case TERM_STRING: {
     String string = term->string;
-    print_char('"');
+    print_char(output, '"');
     for (U64 i = 0; i < string.size; i++) {
       U8 c = string.data[i];
       if (c == '\n') {
-	print(string("\\n"));
+	print(output, string("\\n"));
       } else if (c == '\\') {
-	print(string("\\\\"));
+	print(output, string("\\\\"));
+      } else if (c == '"') {
+	print(output, string("\\\""));
       } else {
-	print_char(string.data[i]);
+	print_char(output, string.data[i]);
       }
     }
-    print_char('"');
+    print_char(output, '"');
     break;
   }
 
   case TERM_INTEGER:
-    print_int(term->integer);
+    print_int(output, term->integer);
     break;
 
   case TERM_NUMBER:
-    print_float(term->number);
+    print_float(output, term->number);
     break;
 
   case TERM_LIST:
-    print_char('(');
+    print_char(output, '(');
     Term* current = term;
     while (current->list.head != NULL && current->list.tail != NULL) {
       if (current != term) {
-	print_char(' ');
+	print_char(output, ' ');
       }
-      print_term(current->list.head);
+      print_term(output, current->list.head);
       current = current->list.tail;
+      // A stream ends in a promise rather than a list.
+      if (current->kind != TERM_LIST) {
+	print(output, string(" . "));
+	print_term(output, current);
+	break;
+      }
     }
-    print_char(')');
+    print_char(output, ')');
     break;
 
   case TERM_BUILT_IN:
-    print(string("<built_in_"));
-    print(built_in_names[term->built_in]);
-    print_char('>');
+    print(output, string("<built_in_"));
+    print(output, built_in_names[term->built_in]);
+    print_char(output, '>');
     break;
 
   case TERM_PROCEDURE: {
     Procedure* procedure = &term->procedure;
-    print_char('<');
-    print(procedure->name);
+    print_char(output, '<');
+    print(output, procedure->name);
     for (Term* i = procedure->parameters; i->list.head && i->list.tail; i = i->list.tail) {
-      print_char(' ');
-      print(i->list.head->atom);
+      print_char(output, ' ');
+      print(output, i->list.head->atom);
     }
-    print_char('>');
+    print_char(output, '>');
     break;
   }
+
+  case TERM_TABLE:
+    print(output, string("<table "));
+    print_int(output, term->table->count);
+    print_char(output, '>');
+    break;
+
+  case TERM_VECTOR:
+    print(output, string("<vector "));
+    print_int(output, term->vector->count);
+    print_char(output, '>');
+    break;
+
+  case TERM_PROMISE:
+    print(output, term->promise->value != NULL ? string("<forced promise>") : string("<promise>"));
+    break;
   };
 }
 
@@ -235,7 +611,7 @@ static String clear_blanks(String input) {
   return input;
 }
 
-LexResult lex(Arena* arena, String input) {
+static LexResult lex(Arena* arena, String input) {
   input = clear_blanks(input);
 
   TokenKind kind    = TOKEN_END;
@@ -252,28 +628,39 @@ LexResult lex(Arena* arena, String input) {
       kind = TOKEN_STRING;
       input.data++;
       input.size--;
-      B32 escaped = false;
 
-      token.data = arena_allocate_bytes(arena, 0, 1);
-      
-      while (input.size > 0 && *input.data != '"') {
-	if (escaped) {
-	  assert(*input.data == '\\' || *input.data == 'n');
-	  *arena_allocate_bytes(arena, 1, 1) = *input.data == '\\' ? '\\' : '\n';
-	  token.size++;
-	  escaped = false;
-	} else if (*input.data == '\\') {
-	  escaped = true;
-	} else {
-	  *arena_allocate_bytes(arena, 1, 1) = *input.data;
-	  token.size++;
+      // A string without escapes points into the input; only one with
+      // escapes is copied, once its length is known.
+      U64 size    = 0;
+      U64 escapes = 0;
+      while (size < input.size && input.data[size] != '"') {
+	if (input.data[size] == '\\') {
+	  assert(size + 1 < input.size);
+	  U8 escaped = input.data[size + 1];
+	  assert(escaped == '\\' || escaped == 'n' || escaped == '"');
+	  escapes++;
+	  size++;
 	}
-	input.data++;
-	input.size--;	
+	size++;
       }
-      assert(input.size > 0);
-      input.data++;
-      input.size--;      
+      assert(size < input.size);
+
+      token.data = input.data;
+      token.size = size;
+      if (escapes > 0) {
+	token.data = arena_allocate_bytes(arena, size - escapes, 1, SITE_STRING);
+	token.size = 0;
+	for (U64 i = 0; i < size; i++) {
+	  U8 c = input.data[i];
+	  if (c == '\\') {
+	    i++;
+	    c = input.data[i] == 'n' ? '\n' : input.data[i];
+	  }
+	  token.data[token.size++] = c;
+	}
+      }
+      input.data += size + 1;
+      input.size -= size + 1;
     } else if (is_digit(*input.data) ||
 	       (*input.data == '-' && input.size > 0 && is_digit(input.data[1]))) {
       B32 negative = *input.data == '-';
@@ -319,7 +706,7 @@ LexResult lex(Arena* arena, String input) {
       }
     }
   }
-  if (token.size == 0) {
+  if (kind != TOKEN_STRING) {
     token.size = input.data - token.data;
   }
 
@@ -332,12 +719,7 @@ LexResult lex(Arena* arena, String input) {
   return result;
 }
 
-typedef struct {
-  Term*  term;
-  String rest;
-} ParseResult;
-
-ParseResult parse(Arena* arena, String input) {
+static ParseResult parse(Arena* arena, String input) {
   LexResult lexed = lex(arena, input);
   input           = lexed.rest;
 
@@ -346,7 +728,7 @@ ParseResult parse(Arena* arena, String input) {
     Term* first      = NULL;
     Term* last       = NULL;
     
-    Term* nil      = arena_allocate(arena, Term);
+    Term* nil      = arena_allocate(arena, Term, SITE_PARSER);
     nil->kind      = TERM_LIST;
     nil->list.head = NULL;
     nil->list.tail = NULL;
@@ -355,7 +737,7 @@ ParseResult parse(Arena* arena, String input) {
       ParseResult parsed = parse(arena, input);
       input              = parsed.rest;
       
-      Term* new      = arena_allocate(arena, Term);
+      Term* new      = arena_allocate(arena, Term, SITE_PARSER);
       new->kind      = TERM_LIST;
       new->list.head = parsed.term;
       new->list.tail = nil;
@@ -372,21 +754,21 @@ ParseResult parse(Arena* arena, String input) {
     assert(input.size > 0);
     input.data++;
     input.size--;
-    term = first;
+    term = first != NULL ? first : nil;
   } else if (lexed.kind == TOKEN_STRING) {
-    term         = arena_allocate(arena, Term);
+    term         = arena_allocate(arena, Term, SITE_PARSER);
     term->kind   = TERM_STRING;
     term->string = lexed.token;
   } else if (lexed.kind == TOKEN_INTEGER) {
-    term          = arena_allocate(arena, Term);
+    term          = arena_allocate(arena, Term, SITE_PARSER);
     term->kind    = TERM_INTEGER;
     term->integer = lexed.integer;
   } else if (lexed.kind == TOKEN_NUMBER) {
-    term         = arena_allocate(arena, Term);
+    term         = arena_allocate(arena, Term, SITE_PARSER);
     term->kind   = TERM_NUMBER;
     term->number = lexed.number;
   } else if (lexed.kind == TOKEN_ATOM) {
-    term       = arena_allocate(arena, Term);
+    term       = arena_allocate(arena, Term, SITE_PARSER);
     term->kind = TERM_ATOM;
     term->atom = lexed.token;
   } else {
@@ -408,6 +790,8 @@ struct Values {
   Values* next;
 };
 
+#include "native.h"
+
 static Term* find_value(Values* values, String name) {
   for (Values* i = values; i != NULL; i = i->next) {
     if (strings_equal(name, i->name)) {
@@ -417,6 +801,32 @@ static Term* find_value(Values* values, String name) {
   return NULL;
 }
 
+// A call's frame can only outlive it if a procedure is created while the call
+// runs. This finds the bodies that create one directly; closures created by
+// callees, which link back to the caller's frame, are caught at run time by
+// arena_pin.
+static B32 creates_procedure(Term* term) {
+  if (term == NULL || term->kind != TERM_LIST || is_nil_term(term)) {
+    return false;
+  }
+  Term* head = term->list.head;
+  if (head->kind == TERM_ATOM) {
+    if (strings_equal(head->atom, string("lambda"))) {
+      return true;
+    }
+    if (strings_equal(head->atom, string("define")) && !is_nil_term(term->list.tail) &&
+	term->list.tail->list.head->kind == TERM_LIST) {
+      return true;
+    }
+  }
+  for (Term* i = term; i->list.head && i->list.tail; i = i->list.tail) {
+    if (creates_procedure(i->list.head)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 static Term* make_procedure(
   Arena* arena, Values* values, String name, Term* parameters, Term* body
 ) {
@@ -424,7 +834,7 @@ static Term* make_procedure(
     assert(i->list.head->kind == TERM_ATOM);
   }
 	
-  Term* value = arena_allocate(arena, Term);
+  Term* value = arena_allocate(arena, Term, SITE_CLOSURE);
   value->kind = TERM_PROCEDURE;
 	
   Procedure* procedure  = &value->procedure;
@@ -432,37 +842,247 @@ static Term* make_procedure(
   procedure->captured   = values;
   procedure->parameters = parameters;
   procedure->body       = body;
+  procedure->escapes    = creates_procedure(body);
+  procedure->native     = NULL;
   assert(procedure->body != NULL);
+  arena_pin(arena);
   return value;
 }
 
-static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
+// Releases everything a call allocated past "mark" when nothing can refer to
+// it afterwards: no procedure was created or other memory pinned during the
+// call and the result does not point into the arena. The result is moved to
+// the start of the released region.
+static Term* release_temporaries(Context* context, U64 mark, Term* output) {
+  Arena* arena = &context->arena;
+  if (!arena_releasable(arena, mark) || output == &context->nil || output == &context->t) {
+    return output;
+  }
+  if (output->kind != TERM_INTEGER && output->kind != TERM_NUMBER && output->kind != TERM_BUILT_IN) {
+    return output;
+  }
+  Term saved = *output;
+  arena_restore(arena, mark);
+  output     = arena_allocate(arena, Term, SITE_VALUE);
+  *output    = saved;
+  return output;
+}
+
+// Arithmetic nested in arithmetic is computed on unboxed values, so a chain
+// like (/ (+ x (* 2 y)) 3) allocates only its final result instead of one term
+// per operand and intermediate. Returns the built-in "operator" is when it is
+// one of those handled this way.
+static BuiltInFn arithmetic_operator(Term* operator) {
+  if (operator == NULL || operator->kind != TERM_BUILT_IN) {
+    return NULL;
+  }
+  BuiltInFn function = built_ins[operator->built_in];
+  if (function == built_in_add || function == built_in_subtract ||
+      function == built_in_multiply || function == built_in_divide ||
+      function == built_in_less_than || function == built_in_greater_than ||
+      function == built_in_remainder || function == built_in_sin ||
+      function == built_in_cos || function == built_in_log) {
+    return function;
+  }
+  return NULL;
+}
+
+// Special forms are never bound, so looking one up would only walk the whole
+// environment to fail.
+static B32 is_special_form(String name) {
+  return strings_equal(name, string("let")) || strings_equal(name, string("lambda")) ||
+	 strings_equal(name, string("define")) || strings_equal(name, string("delay")) ||
+	 strings_equal(name, string("cons-stream"));
+}
+
+// The value the head of an application names, or NULL when the head is not a
+// name or is a special form.
+static Term* resolve_operator(Values* values, Term* term) {
+  if (term->kind != TERM_LIST || is_nil_term(term) || term->list.head->kind != TERM_ATOM ||
+      is_special_form(term->list.head->atom)) {
+    return NULL;
+  }
+  return find_value(values, term->list.head->atom);
+}
+
+static Native evaluate_arithmetic(Context* context, Values* values, BuiltInFn function, Term* operands);
+
+static Native evaluate_unboxed(Context* context, Values* values, Term* term) {
+  if (term->kind == TERM_INTEGER || term->kind == TERM_NUMBER) {
+    return unbox(term);
+  }
+  if (term->kind == TERM_ATOM) {
+    Term* value = find_value(values, term->atom);
+    if (value != NULL && (value->kind == TERM_INTEGER || value->kind == TERM_NUMBER)) {
+      return unbox(value);
+    }
+  }
+  BuiltInFn function = arithmetic_operator(resolve_operator(values, term));
+  if (function == NULL) {
+    return unbox(evaluate_term(context, values, term).term);
+  }
+  return evaluate_arithmetic(context, values, function, term->list.tail);
+}
+
+// Follows the built-in "function" exactly, including the order operands are
+// evaluated in and when integers are promoted to floats.
+static Native evaluate_arithmetic(Context* context, Values* values, BuiltInFn function, Term* operands) {
+  assert(operands->kind == TERM_LIST);
+  if (function == built_in_add || function == built_in_multiply) {
+    Native result = native_integer(function == built_in_add ? 0 : 1);
+    for (Term* i = operands; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
+      Native operand = evaluate_unboxed(context, values, i->list.head);
+      result = function == built_in_add ? native_add(result, operand) : native_multiply(result, operand);
+    }
+    return result;
+  }
+
+  assert(!is_nil_term(operands));
+  Native first = evaluate_unboxed(context, values, operands->list.head);
+  Term*  rest  = operands->list.tail;
+  if (function == built_in_subtract || function == built_in_divide) {
+    if (function == built_in_subtract && is_nil_term(rest)) {
+      return native_negate(first);
+    }
+    assert(is_native_number(first));
+    for (Term* i = rest; i->list.head != NULL && i->list.tail != NULL; i = i->list.tail) {
+      Native operand = evaluate_unboxed(context, values, i->list.head);
+      first = function == built_in_subtract ? native_subtract(first, operand) : native_divide(first, operand);
+    }
+    return first;
+  }
+  if (function == built_in_sin) {
+    return native_sin(first);
+  } else if (function == built_in_cos) {
+    return native_cos(first);
+  } else if (function == built_in_log) {
+    return native_log(first);
+  }
+
+  assert(rest->kind == TERM_LIST && !is_nil_term(rest));
+  Native second = evaluate_unboxed(context, values, rest->list.head);
+  if (function == built_in_less_than) {
+    return native_less_than(first, second);
+  } else if (function == built_in_greater_than) {
+    return native_greater_than(first, second);
+  }
+  return native_remainder(first, second);
+}
+
+static Term* call_on_stack(
+  Context* context, Values* values, Procedure* procedure, Values* arguments, Values* first, B32 numeric
+);
+
+// Runs "procedure" on arguments that already have values. "arguments" is the
+// frame for the call, listing the last parameter first and ending at "first",
+// and "values" is the caller's environment.
+static Term* call_procedure(
+  Context* context, Values* values, Procedure* procedure, Values* arguments, Values* first, B32 numeric
+) {
+  if (procedure->native != NULL && numeric) {
+    return call_native(context, procedure->native, arguments);
+  }
+
+  EvaluationStack* stack = &context->stack;
+  U8*              frame = __builtin_frame_address(0);
+  if (!stack->running) {
+    if ((U64) stack->base - (U64) frame > EVALUATION_NATIVE_DEPTH) {
+      return call_on_stack(context, values, procedure, arguments, first, numeric);
+    }
+  } else if (frame < stack->lowest) {
+    stack->lowest = frame;
+  }
+
+  Arena*    arena    = &context->arena;
+  Values*   scope    = values;
+  Values*   last     = NULL;
+  String    caller   = profile_enter(arena, procedure->name);
+  Governor* governor = arena->governor;
+  if (governor != NULL && ++governor->calls > governor->deepest) {
+    governor_deeper(governor);
+  }
+
+  for (Values* i = procedure->captured; i != NULL; i = i->next) {
+    Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
+    *new        = *i;
+    new->next   = scope;
+    if (scope == values) {
+      scope = new;
+      last  = new;
+    } else {
+      last->next = new;
+      last       = new;
+    }
+  }
+  if (last != NULL) {
+    last->next = values;
+  }
+  if (first != NULL) {
+    first->next = scope;
+    scope       = arguments;
+  }
+
+  Term* output = &context->nil;
+  for (Term* body = procedure->body; !is_nil_term(body); body = body->list.tail) {
+    assert(body->kind == TERM_LIST);
+    EvaluateResult result = evaluate_term(context, scope, body->list.head);
+    output                = result.term;
+    scope                 = result.values;
+  }
+  profile_enter(arena, caller);
+  if (governor != NULL) {
+    governor->calls--;
+  }
+  return output;
+}
+
+static EvaluateResult evaluate_term(Context* context, Values* values, Term* input) {
+  Arena* arena = &context->arena;
   Term* output;
 
+  Governor* governor = arena->governor;
+  if (governor != NULL && --governor->fuel == 0) {
+    governor_tick(governor);
+  }
+
   switch (input->kind) {
 
+  // Only literals are parsed, but built-ins that build expressions, as
+  // stream-map does, put procedures and promises in them directly.
   case TERM_STRING:
   case TERM_INTEGER:
   case TERM_NUMBER:
-    output  = arena_allocate(arena, Term);
+  case TERM_BUILT_IN:
+  case TERM_PROCEDURE:
+  case TERM_TABLE:
+  case TERM_VECTOR:
+  case TERM_PROMISE:
+    output  = arena_allocate(arena, Term, SITE_VALUE);
     *output = *input;
     break;
 
   case TERM_ATOM: {
     Term* value = find_value(values, input->atom);
     if (value == NULL) {
-      print(string("Undefined value "));
-      print(input->atom);
-      print(string(".\n"));
-      exit(EXIT_FAILURE);
+      print(&context->output, string("Undefined value "));
+      print(&context->output, input->atom);
+      print(&context->output, string(".\n"));
+      fail(context);
     }
-    output  = arena_allocate(arena, Term);
+    // Evaluation returns a term the caller may change, as "define" does when
+    // it sets the environment a procedure captures. Built-ins that return a
+    // value stored elsewhere, such as a table entry, copy it the same way.
+    output  = arena_allocate(arena, Term, SITE_VALUE);
     *output = *value;
     break;
   }
 
   case TERM_LIST:
-    assert(input->list.head != NULL && input->list.tail != NULL);
+    // "()" is nil, as "the-empty-stream" is.
+    if (is_nil_term(input)) {
+      output = &context->nil;
+      break;
+    }
     Term* head = input->list.head;
     if (head->kind == TERM_ATOM && strings_equal(head->atom, string("let"))) {
       input = input->list.tail;
@@ -478,15 +1098,15 @@ static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
 	assert(binding->list.tail->kind == TERM_LIST && !is_nil_term(binding->list.tail));
 	Term* name    = binding->list.head;
 	assert(name->kind == TERM_ATOM);
-	Term* value = evaluate_term(arena, values, binding->list.tail->list.head).term;
+	Term* value = evaluate_term(context, values, binding->list.tail->list.head).term;
 	
-	Values* new = arena_allocate(arena, Values);
+	Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
 	new->name   = name->atom;
 	new->value  = value;
 	new->next   = new_values;
 	new_values  = new;
       }
-      return evaluate_term(arena, new_values, body);
+      return evaluate_term(context, new_values, body);
     } if (head->kind == TERM_ATOM && strings_equal(head->atom, string("lambda"))) {
       input = input->list.tail;
       assert(!is_nil_term(input));
@@ -494,6 +1114,21 @@ static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
       assert(header->kind == TERM_LIST);
       output = make_procedure(arena, values, string("lambda"),  header, input->list.tail);
       break;
+    } if (head->kind == TERM_ATOM && strings_equal(head->atom, string("delay"))) {
+      input = input->list.tail;
+      assert(!is_nil_term(input));
+      output = make_promise(arena, values, input->list.head);
+      break;
+    } if (head->kind == TERM_ATOM && strings_equal(head->atom, string("cons-stream"))) {
+      input = input->list.tail;
+      assert(!is_nil_term(input));
+      assert(input->list.tail->kind == TERM_LIST && !is_nil_term(input->list.tail));
+      Term* first       = evaluate_term(context, values, input->list.head).term;
+      output            = arena_allocate(arena, Term, SITE_STREAM);
+      output->kind      = TERM_LIST;
+      output->list.head = first;
+      output->list.tail = make_promise(arena, values, input->list.tail->list.head);
+      break;
     } if (head->kind == TERM_ATOM && strings_equal(head->atom, string("define"))) {
       input = input->list.tail;
       
@@ -508,13 +1143,13 @@ static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
 	input = input->list.tail;
       
 	assert(input->list.head != NULL && input->list.tail != NULL);
-	value = evaluate_term(arena, values, input->list.head).term;
+	value = evaluate_term(context, values, input->list.head).term;
       } else {
 	assert(header->list.head->kind == TERM_ATOM);
 	name  = header->list.head->atom;
 	value = make_procedure(arena, values, name, header->list.tail, input->list.tail);
       }
-      Values* new = arena_allocate(arena, Values);
+      Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
       new->name   = name;
       new->value  = value;
       new->next   = values;
@@ -526,53 +1161,59 @@ static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
       break;
     }
     
-    Term* operator = evaluate_term(arena, values, input->list.head).term;
+    // The special forms were handled above, so a name in the head is looked
+    // up once, and the value found is used without being copied.
+    U64       mark       = arena->used;
+    Term*     operator   = head->kind == TERM_ATOM ? find_value(values, head->atom) : NULL;
+    BuiltInFn arithmetic = arithmetic_operator(operator);
+    if (arithmetic != NULL) {
+      output = box(context, evaluate_arithmetic(context, values, arithmetic, input->list.tail));
+      output = release_temporaries(context, mark, output);
+      break;
+    }
+
+    if (operator == NULL) {
+      operator = evaluate_term(context, values, head).term;
+    }
     Term* operands = input->list.tail;
     assert(operator->kind == TERM_BUILT_IN || operator->kind == TERM_PROCEDURE);
     if (operator->kind == TERM_BUILT_IN) {
-      output = built_ins[operator->built_in](arena, values, operands);
+      output = built_ins[operator->built_in](context, values, operands);
     } else if (operator->kind == TERM_PROCEDURE) {
       Procedure* procedure = &operator->procedure;
-      Values*    scope     = values;
-      Values*    last      = NULL;
-
-      for (Values* i = procedure->captured; i != NULL; i = i->next) {
-	Values* new = arena_allocate(arena, Values);
-	*new        = *i;
-	new->next   = scope;
-	if (scope == values) {
-	  scope = new;
-	  last  = new;
-	} else {
-	  last->next = new;
-	  last       = new;
-	}
-      }
-      if (last != NULL) {
-	last->next = values;
-      }
-      
+
+      // Operands are evaluated in the caller's environment, so the frame they
+      // are bound in is only built once they all have values.
+      Values* arguments = NULL;
+      Values* first     = NULL;
+      B32     numeric   = true;
       for (Term* i = procedure->parameters; i->list.head && i->list.tail; i = i->list.tail) {
 	assert(operands->kind == TERM_LIST);
 	assert(operands->list.head && operands->list.tail);
-	Values* new = arena_allocate(arena, Values);
+	Term* value = evaluate_term(context, values, operands->list.head).term;
+
+	Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
 	new->name   = i->list.head->atom;
-	new->value  = evaluate_term(arena, values, operands->list.head).term;
-	new->next   = scope;
-	scope       = new;
+	new->value  = value;
+	new->next   = arguments;
+	arguments   = new;
 	operands    = operands->list.tail;
+	if (first == NULL) {
+	  first = new;
+	}
+	numeric = numeric && (value->kind == TERM_INTEGER || value->kind == TERM_NUMBER);
       }
       assert(is_nil_term(operands));
 
-      output = &term_nil;
-      for (Term* body = procedure->body; !is_nil_term(body); body = body->list.tail) {
-	assert(body->kind == TERM_LIST);
-	EvaluateResult result = evaluate_term(arena, scope, body->list.head);
-	output                = result.term;
-	scope                 = result.values;
-      }
+      output = call_procedure(context, values, procedure, arguments, first, numeric);
+    }
+    if (operator->kind == TERM_BUILT_IN || !operator->procedure.escapes) {
+      output = release_temporaries(context, mark, output);
     }
     break;
+
+  default:
+    assert(false);
   }
 
   EvaluateResult result;
@@ -581,46 +1222,471 @@ static EvaluateResult evaluate_term(Arena* arena, Values* values, Term* input) {
   return result;
 }
 
-int main(int argc, char** argv) {
-  atexit(flush);
-  srand(time(NULL));
-
-  if (argc != 2) {
-    print(string("Expected exactly one argument.\nUsage: vlisp program.vl\n"));
-    exit(EXIT_FAILURE);
+// Calls a procedure or built-in on values rather than expressions, as map and
+// fold do for every element. A procedure gets its frame built directly; a
+// built-in, which takes expressions, gets each value wrapped in a promise that
+// is already forced.
+static Term* apply(Context* context, Values* values, Term* function, Term** arguments, U64 count) {
+  if (function->kind == TERM_BUILT_IN) {
+    return evaluate_term(context, values, make_application(context, function, arguments, count)).term;
   }
-  
-  Arena arena;
-  arena_initialize(&arena, 1ull << 32);
+  assert(function->kind == TERM_PROCEDURE);
+
+  Arena*     arena     = &context->arena;
+  U64        mark      = arena->used;
+  Procedure* procedure = &function->procedure;
+  Values*    frame     = NULL;
+  Values*    first     = NULL;
+  B32        numeric   = true;
+  U64        index     = 0;
+  for (Term* i = procedure->parameters; i->list.head && i->list.tail; i = i->list.tail) {
+    assert(index < count);
+    Term* value = arguments[index++];
+
+    Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
+    new->name   = i->list.head->atom;
+    new->value  = value;
+    new->next   = frame;
+    frame       = new;
+    if (first == NULL) {
+      first = new;
+    }
+    numeric = numeric && (value->kind == TERM_INTEGER || value->kind == TERM_NUMBER);
+  }
+  assert(index == count);
+
+  Term* output = call_procedure(context, values, procedure, frame, first, numeric);
+  return procedure->escapes ? output : release_temporaries(context, mark, output);
+}
 
-  String input = read_file(argv[1]);
-  input        = clear_blanks(input);
+#include "optimize.h"
+
+static void call_on_stack_entry(U32 high, U32 low) {
+  Context*         context = (Context*) (((U64) high << 32) | low);
+  EvaluationStack* stack   = &context->stack;
+  stack->output = call_procedure(context, stack->values, stack->procedure, stack->arguments, stack->first, stack->numeric);
+}
+
+// Runs a call on the context's evaluation stack. The lowest page of the
+// stack is left inaccessible, so running off its end faults instead of
+// writing over other memory. Once the call is done the pages it used below
+// the top chunk, down to EVALUATION_STACK_SLACK under its deepest call, are
+// handed back to the system.
+static Term* call_on_stack(
+  Context* context, Values* values, Procedure* procedure, Values* arguments, Values* first, B32 numeric
+) {
+  EvaluationStack* stack = &context->stack;
+  if (stack->memory == NULL) {
+    stack->size   = context->arena.capacity;
+    stack->memory = mmap(NULL, stack->size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    assert(stack->memory != MAP_FAILED);
+    assert(mprotect(stack->memory, ARENA_PAGE, PROT_NONE) == 0);
+  }
+  stack->procedure = procedure;
+  stack->values    = values;
+  stack->arguments = arguments;
+  stack->first     = first;
+  stack->numeric   = numeric;
+  stack->lowest    = &stack->memory[stack->size];
+  stack->running   = true;
+  stack->failed    = false;
+
+  assert(getcontext(&stack->callee) == 0);
+  stack->callee.uc_stack.ss_sp   = stack->memory;
+  stack->callee.uc_stack.ss_size = stack->size;
+  stack->callee.uc_link          = &stack->caller;
+  U64 address = (U64) context;
+  makecontext(&stack->callee, (void (*)(void)) call_on_stack_entry, 2,
+	      (U32) (address >> 32), (U32) address);
+  assert(swapcontext(&stack->caller, &stack->callee) == 0);
+  stack->running = false;
+
+  U64 keep = stack->size - ARENA_CHUNK;
+  U64 used = stack->lowest - stack->memory;
+  U64 from = used > ARENA_PAGE + EVALUATION_STACK_SLACK ? (used - EVALUATION_STACK_SLACK) & ~(ARENA_PAGE - 1) : ARENA_PAGE;
+  if (from < keep) {
+    madvise(&stack->memory[from], keep - from, MADV_DONTNEED);
+  }
+  if (stack->failed) {
+    longjmp(*context->failure, 1);
+  }
+  return stack->output;
+}
 
-  Values* values = NULL;
+static void define_built_ins(Context* context) {
+  Arena*  arena  = &context->arena;
+  Values* values = context->values;
   for (U64 i = 0; i < length(built_ins); i++) {
-    Term* term     = arena_allocate(&arena, Term);
+    Term* term     = arena_allocate(arena, Term, SITE_OTHER);
     term->kind     = TERM_BUILT_IN;
     term->built_in = i;
     
-    Values* new = arena_allocate(&arena, Values);
+    Values* new = arena_allocate(arena, Values, SITE_ENVIRONMENT);
     new->name   = built_in_names[i];
     new->value  = term;
     new->next   = values;
     values      = new;
   }
 
-  while (input.size > 0) {
-    ParseResult parsed = parse(&arena, input);
-    input              = parsed.rest;
-    print(string("> "));
-    print_term(parsed.term);
-    print_char('\n');
+  Values* empty = arena_allocate(arena, Values, SITE_ENVIRONMENT);
+  empty->name   = string("the-empty-stream");
+  empty->value  = &context->nil;
+  empty->next   = values;
+  values        = empty;
 
-    EvaluateResult result = evaluate_term(&arena, values, parsed.term);
-    values                = result.values;
-    print_term(result.term);
-    print_char('\n');
+  context->values = values;
+}
+
+// A form that defines nothing and creates no procedure leaves nothing behind,
+// so all it allocated since "mark" is released once its result is printed. A
+// compiled program attaches the C function for form i to the procedure it
+// evaluates to. A quiet context prints neither the form nor its result.
+static void evaluate_form(Context* context, U64 form, Term* term, U64 mark, B32 optimize) {
+  Output* output = &context->output;
+  if (!context->quiet) {
+    print(output, string("> "));
+    print_term(output, term);
+    print_char(output, '\n');
+  }
 
-    input = clear_blanks(input);
+  // Calls measure how deep they have gone on the native stack from here.
+  context->stack.base = __builtin_frame_address(0);
+  if (optimize) {
+    term = optimize_term(context, context->values, term);
+  }
+  EvaluateResult result = evaluate_term(context, context->values, term);
+  if (form < context->native_count && context->natives[form] != NULL &&
+      result.term->kind == TERM_PROCEDURE) {
+    result.term->procedure.native = context->natives[form];
   }
+  if (!context->quiet) {
+    print_term(output, result.term);
+    print_char(output, '\n');
+  }
+
+  if (result.values == context->values && arena_releasable(&context->arena, mark)) {
+    arena_restore(&context->arena, mark);
+  }
+  context->values = result.values;
+}
+
+static void evaluate_program(Context* context, String input, B32 optimize) {
+  input = clear_blanks(input);
+  for (U64 form = 0; input.size > 0; form++) {
+    U64         mark   = arena_mark(&context->arena);
+    ParseResult parsed = parse(&context->arena, input);
+    evaluate_form(context, form, parsed.term, mark, optimize);
+    input = clear_blanks(parsed.rest);
+  }
+}
+
+#ifdef VLISP_COMMAND
+#include "precompiled.h"
+#include "serve.h"
+#include "batch.h"
+#include "watch.h"
+#include "compile.h"
+#endif
+
+#ifndef VLISP_LIBRARY
+// Reads a byte count with an optional "k", "m" or "g" suffix, or returns 0.
+static U64 parse_size(char* text) {
+  U64 size = 0;
+  for (; is_digit(*text); text++) {
+    size = size * 10 + (*text - '0');
+  }
+  if (*text == 'k' || *text == 'K') {
+    size <<= 10;
+    text++;
+  } else if (*text == 'm' || *text == 'M') {
+    size <<= 20;
+    text++;
+  } else if (*text == 'g' || *text == 'G') {
+    size <<= 30;
+    text++;
+  }
+  return *text == 0 ? size : 0;
+}
+#endif
+
+#ifdef VLISP_LIBRARY
+
+#include "vlisp.h"
+
+VlispContext* vlisp_create(unsigned long long capacity, VlispOutputFn output, void* user) {
+  Context* context = context_create(capacity, STDOUT_FILENO, (OutputFn) output, user);
+  define_built_ins(context);
+  return context;
+}
+
+void vlisp_seed(VlispContext* context, unsigned long long seed) {
+  context_seed(context, seed);
+}
+
+int vlisp_evaluate(VlispContext* context, const char* source, unsigned long long size) {
+  // Atoms and strings point into the program text, so it is kept in the arena.
+  U8* copy = arena_allocate_bytes(&context->arena, size, 1, SITE_OTHER);
+  memcpy(copy, source, size);
+
+  jmp_buf failure;
+  int     status = 0;
+  context->failure = &failure;
+  if (context->arena.governor != NULL) {
+    governor_start(context->arena.governor);
+  }
+  if (setjmp(failure) == 0) {
+    evaluate_program(context, (String) { .data = copy, .size = size }, false);
+  } else {
+    status = -1;
+  }
+  context->failure = NULL;
+  flush(&context->output);
+  return status;
+}
+
+void vlisp_limit(
+  VlispContext* context, unsigned long long steps, unsigned long long memory,
+  unsigned long long depth, unsigned long long milliseconds
+) {
+  if (context->arena.governor != NULL) {
+    munmap(context->arena.governor, sizeof(Governor));
+  }
+  context->arena.governor = NULL;
+  context->arena.limit    = context->arena.capacity;
+  if (steps != 0 || memory != 0 || depth != 0 || milliseconds != 0) {
+    context->arena.governor = governor_create(context, steps, memory, depth, milliseconds);
+  }
+}
+
+void vlisp_destroy(VlispContext* context) {
+  flush(&context->output);
+  munmap(context->output.buffer, context->output.capacity);
+  if (context->arena.governor != NULL) {
+    munmap(context->arena.governor, sizeof(Governor));
+  }
+  if (context->stack.memory != NULL) {
+    munmap(context->stack.memory, context->stack.size);
+  }
+  Arena arena = context->arena;
+  arena_unmap(&arena, 0);
+  munmap(arena.memory, arena.capacity);
+}
+
+#elif defined(VLISP_PROGRAM)
+
+// The entry point of a compiled program. It takes the same limits as the
+// command, and compiled procedures are stopped by them as well.
+static int run_compiled(NativeFn* natives, U64 count, String source, int argc, char** argv) {
+  Context* context = context_create(1ull << 32, STDOUT_FILENO, NULL, NULL);
+  context_seed(context, time(NULL));
+  context->natives      = natives;
+  context->native_count = count;
+
+  U64 steps   = 0;
+  U64 memory  = 0;
+  U64 depth   = 0;
+  U64 timeout = 0;
+  B32 valid   = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+      steps = parse_size(argv[++i]);
+      valid = valid && steps > 0;
+    } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+      memory = parse_size(argv[++i]);
+      valid  = valid && memory > 0;
+    } else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      depth = parse_size(argv[++i]);
+      valid = valid && depth > 0;
+    } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+      timeout = parse_size(argv[++i]);
+      valid   = valid && timeout > 0;
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid) {
+    print(&context->output, string(
+      "Usage: program [--max-steps count] [--max-memory size] [--max-depth count] [--timeout ms]\n"
+    ));
+    fail(context);
+  }
+
+  define_built_ins(context);
+  if (steps != 0 || memory != 0 || depth != 0 || timeout != 0) {
+    context->arena.governor = governor_create(context, steps, memory, depth, timeout);
+    governor_start(context->arena.governor);
+  }
+  evaluate_program(context, source, false);
+  flush(&context->output);
+  return 0;
 }
+
+#else
+
+int main(int argc, char** argv) {
+  B32   optimize   = false;
+  U64   chunk      = ARENA_CHUNK;
+  B32   huge_pages = false;
+  B32   profiling  = false;
+  U64   interval   = 64ull << 20;
+  char* serving    = NULL;
+  char* sending    = NULL;
+  B32   emitting   = false;
+  B32   caching    = false;
+  U64   steps      = 0;
+  U64   memory     = 0;
+  U64   depth      = 0;
+  U64   timeout    = 0;
+  B32   batching   = false;
+  B32   quiet      = false;
+  B32   watching   = false;
+  U64   buffer     = OUTPUT_BUFFER;
+  B32   threaded   = false;
+  U64   workers    = sysconf(_SC_NPROCESSORS_ONLN);
+  char* path       = NULL;
+  B32   valid      = true;
+
+  // Every file after the first is a job for --batch. They are gathered at the
+  // front of argv, whose entries are never read again once passed.
+  char** jobs      = argv;
+  U64    job_count = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--optimize") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[i], "--arena-chunk") == 0 && i + 1 < argc) {
+      chunk = parse_size(argv[++i]);
+      valid = valid && chunk > 0;
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      huge_pages = true;
+    } else if (strcmp(argv[i], "--heap-profile") == 0) {
+      profiling = true;
+    } else if (strcmp(argv[i], "--heap-profile-interval") == 0 && i + 1 < argc) {
+      profiling = true;
+      interval  = parse_size(argv[++i]);
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serving = argv[++i];
+    } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+      sending = argv[++i];
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      emitting = true;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      caching = true;
+    } else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+      steps = parse_size(argv[++i]);
+      valid = valid && steps > 0;
+    } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+      memory = parse_size(argv[++i]);
+      valid = valid && memory > 0;
+    } else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      depth = parse_size(argv[++i]);
+      valid = valid && depth > 0;
+    } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+      timeout = parse_size(argv[++i]);
+      valid = valid && timeout > 0;
+    } else if (strcmp(argv[i], "--watch") == 0) {
+      watching = true;
+    } else if (strcmp(argv[i], "--quiet") == 0) {
+      quiet = true;
+    } else if (strcmp(argv[i], "--output-buffer") == 0 && i + 1 < argc) {
+      buffer = parse_size(argv[++i]);
+      valid  = valid && buffer > 0;
+    } else if (strcmp(argv[i], "--output-thread") == 0) {
+      threaded = true;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      batching = true;
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      workers = parse_size(argv[++i]);
+      valid   = valid && workers > 0;
+    } else if (path == NULL && strncmp(argv[i], "--", 2) != 0) {
+      path = argv[i];
+    } else if (strncmp(argv[i], "--", 2) != 0) {
+      jobs[job_count++] = argv[i];
+    } else {
+      valid = false;
+    }
+  }
+
+  Context* context = context_create(1ull << 32, STDOUT_FILENO, NULL, NULL);
+  Output*  output  = &context->output;
+  context_seed(context, time(NULL));
+  arena_configure(&context->arena, chunk, huge_pages);
+
+  valid = valid && (job_count == 0 || batching) && (!batching || (path != NULL && serving == NULL));
+  valid = valid && (!watching || (path != NULL && serving == NULL && !batching));
+  if (!valid || (path == NULL && serving == NULL) || (serving != NULL && sending != NULL)) {
+    print(output, string(
+      "Usage: vlisp [options] program.vl\n"
+      "       vlisp [options] --serve socket [prelude.vl]\n"
+      "       vlisp --connect socket program.vl\n"
+      "       vlisp [options] --batch [--jobs count] prelude.vl job.vl...\n"
+      "       vlisp [options] --watch program.vl\n"
+      "       vlisp --emit-c program.vl > program.c\n"
+      "Options:\n"
+      "  --optimize           Fold constants and inline small procedures.\n"
+      "  --cache              Keep the parsed program in program.vl.vlc.\n"
+      "  --arena-chunk size   Commit arena memory in chunks of this many bytes.\n"
+      "  --huge-pages         Ask for transparent huge pages for the arena.\n"
+      "  --heap-profile       Report arena allocations by site and procedure.\n"
+      "  --heap-profile-interval size\n"
+      "                       Print a heap snapshot after every size bytes.\n"
+      "  --max-steps count    Stop after evaluating this many terms.\n"
+      "  --max-memory size    Stop when the arena needs more than size bytes.\n"
+      "  --max-depth count    Stop when calls nest deeper than this.\n"
+      "  --timeout ms         Stop after this many milliseconds.\n"
+      "  --quiet              Print only what the program displays.\n"
+      "  --output-buffer size Buffer this many bytes of output.\n"
+      "  --output-thread      Write output from a thread of its own.\n"
+    ));
+    fail(context);
+  }
+
+  // A forked request or job would inherit the writer but not its thread.
+  if (buffer != OUTPUT_BUFFER || threaded) {
+    output_configure(output, buffer, threaded && serving == NULL && !batching);
+  }
+  context->quiet = quiet;
+
+  if (emitting && path != NULL) {
+    emit_program(context, read_file(path));
+    flush(output);
+    return 0;
+  }
+
+  if (sending != NULL) {
+    connect_and_send(context, sending, read_file(path));
+    flush(output);
+    return 0;
+  }
+
+  if (profiling) {
+    context->arena.profile = profile_create(interval);
+  }
+
+  define_built_ins(context);
+  if (steps != 0 || memory != 0 || depth != 0 || timeout != 0) {
+    context->arena.governor = governor_create(context, steps, memory, depth, timeout);
+    governor_start(context->arena.governor);
+  }
+  if (path != NULL && watching) {
+    watch(context, path, optimize);
+  } else if (path != NULL && caching) {
+    evaluate_cached(context, path, read_file(path), optimize);
+  } else if (path != NULL) {
+    evaluate_program(context, read_file(path), optimize);
+  }
+  flush(output);
+
+  if (profiling && serving == NULL) {
+    profile_report(context->arena.profile, context->arena.used);
+  }
+
+  if (serving != NULL) {
+    serve(context, serving, optimize);
+  }
+  if (batching) {
+    return run_batch(context, jobs, job_count, workers, optimize) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+}
+
+#endif
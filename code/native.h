@@ -0,0 +1,203 @@
+// Runtime support for procedures compiled to C by --emit-c. Compiled code
+// works on unboxed values, and every operation below follows the built-in of
+// the same name exactly, including when integers are promoted to floats.
+
+#define NATIVE_ARGUMENTS 8
+
+// An integer or float, or t or nil, kept out of the arena. "kind" is
+// TERM_INTEGER, TERM_NUMBER, TERM_ATOM for t or TERM_LIST for nil.
+struct Native {
+  TermKind kind;
+  union {
+    I64 integer;
+    F64 number;
+  };
+};
+
+static Native native_integer(I64 integer) {
+  return (Native) { .kind = TERM_INTEGER, .integer = integer };
+}
+
+static Native native_number(F64 number) {
+  return (Native) { .kind = TERM_NUMBER, .number = number };
+}
+
+// Floats are written out by their bits so the compiled constant is exact.
+#ifdef VLISP_PROGRAM
+static inline Native native_bits(U64 bits) {
+  Native result = { .kind = TERM_NUMBER };
+  memcpy(&result.number, &bits, sizeof bits);
+  return result;
+}
+#endif
+
+static Native native_truth(B32 truth) {
+  return (Native) { .kind = truth ? TERM_ATOM : TERM_LIST };
+}
+
+// This and the other functions under VLISP_PROGRAM are only called by the C
+// that --emit-c generates, and only if the program needs them, so they are
+// inline: one the program never calls is not an unused function.
+#ifdef VLISP_PROGRAM
+static inline B32 native_true(Native value) {
+  return value.kind != TERM_LIST;
+}
+#endif
+
+static B32 is_native_number(Native value) {
+  return value.kind == TERM_INTEGER || value.kind == TERM_NUMBER;
+}
+
+static F64 native_float(Native value) {
+  return value.kind == TERM_INTEGER ? value.integer : value.number;
+}
+
+static Native native_add(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_integer(a.integer + b.integer);
+  }
+  return native_number(native_float(a) + native_float(b));
+}
+
+static Native native_subtract(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_integer(a.integer - b.integer);
+  }
+  return native_number(native_float(a) - native_float(b));
+}
+
+static Native native_negate(Native a) {
+  assert(is_native_number(a));
+  return a.kind == TERM_INTEGER ? native_integer(a.integer * -1) : native_number(a.number * -1);
+}
+
+static Native native_multiply(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_integer(a.integer * b.integer);
+  }
+  return native_number(native_float(a) * native_float(b));
+}
+
+static Native native_divide(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_integer(a.integer / b.integer);
+  }
+  return native_number(native_float(a) / native_float(b));
+}
+
+static Native native_remainder(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_integer(a.integer % b.integer);
+  }
+  return native_number(fmod(native_float(a), native_float(b)));
+}
+
+static Native native_less_than(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_truth(a.integer < b.integer);
+  }
+  return native_truth(native_float(a) < native_float(b));
+}
+
+static Native native_greater_than(Native a, Native b) {
+  assert(is_native_number(a) && is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_truth(a.integer > b.integer);
+  }
+  return native_truth(native_float(a) > native_float(b));
+}
+
+#ifdef VLISP_PROGRAM
+static inline Native native_equal(Native a, Native b) {
+  assert(is_native_number(a) || a.kind == TERM_ATOM);
+  if (a.kind == TERM_ATOM) {
+    return native_truth(b.kind == TERM_ATOM);
+  }
+  assert(is_native_number(b));
+  if (a.kind == TERM_INTEGER && b.kind == TERM_INTEGER) {
+    return native_truth(a.integer == b.integer);
+  }
+  return native_truth(native_float(a) == native_float(b));
+}
+
+static inline Native native_not(Native a) {
+  return native_truth(!native_true(a));
+}
+
+static inline Native native_random(Context* context, Native a) {
+  assert(is_native_number(a));
+  if (a.kind == TERM_INTEGER) {
+    return native_integer(context_random(context) % a.integer);
+  }
+  return native_number(fmod(context_random(context), a.number));
+}
+#endif
+
+static Native native_sin(Native a) {
+  assert(is_native_number(a));
+  return native_number(sin(native_float(a)));
+}
+
+static Native native_cos(Native a) {
+  assert(is_native_number(a));
+  return native_number(cos(native_float(a)));
+}
+
+static Native native_log(Native a) {
+  assert(is_native_number(a));
+  return native_number(log(native_float(a)));
+}
+
+static Native unbox(Term* term) {
+  assert(term->kind == TERM_INTEGER || term->kind == TERM_NUMBER);
+  return term->kind == TERM_INTEGER ? native_integer(term->integer) : native_number(term->number);
+}
+
+static Term* box(Context* context, Native value) {
+  if (value.kind == TERM_ATOM) {
+    return &context->t;
+  } else if (value.kind == TERM_LIST) {
+    return &context->nil;
+  }
+  Term* result = arena_allocate(&context->arena, Term, SITE_ARITHMETIC);
+  result->kind = value.kind;
+  if (value.kind == TERM_INTEGER) {
+    result->integer = value.integer;
+  } else {
+    result->number = value.number;
+  }
+  return result;
+}
+
+// Takes a step, as evaluating a term does. Every call of a compiled procedure
+// takes one, from the interpreter or from other compiled code, so the limits
+// on steps and time stop compiled loops too.
+static inline void native_step(Context* context) {
+  Governor* governor = context->arena.governor;
+  if (governor != NULL && --governor->fuel == 0) {
+    governor_tick(governor);
+  }
+}
+
+// "arguments" is the frame built by a call, which lists the last parameter
+// first.
+static Term* call_native(Context* context, NativeFn native, Values* arguments) {
+  native_step(context);
+  Native unboxed[NATIVE_ARGUMENTS];
+  U64    count = 0;
+  for (Values* i = arguments; i != NULL; i = i->next) {
+    count++;
+  }
+  assert(count <= NATIVE_ARGUMENTS);
+  for (Values* i = arguments; i != NULL; i = i->next) {
+    count--;
+    unboxed[count] = unbox(i->value);
+  }
+  return box(context, native(context, unboxed));
+}
@@ -0,0 +1,482 @@
+// The optimizer rewrites a parsed term before it is evaluated. It folds
+// arithmetic on constants, substitutes globals bound to numbers or strings,
+// removes "if"/"cond" branches whose tests are constant and inlines calls to
+// small procedures whose bodies only use built-ins and their parameters.
+//
+// Globals are looked up in the live environment at the time a form is
+// optimized. A procedure captures that same environment when it is defined,
+// so anything resolved here is exactly what the body would see when it runs,
+// and a later "define" of the same name shadows the old entry for every form
+// optimized afterwards. Names bound by parameters, "let" and internal
+// "define"s are pushed as entries with a NULL value so they hide any global of
+// the same name.
+
+#define INLINE_LIMIT 32
+
+static B32 is_atom_named(Term* term, String name) {
+  return term != NULL && term->kind == TERM_ATOM && strings_equal(term->atom, name);
+}
+
+static B32 is_numeric_term(Term* term) {
+  return term != NULL && (term->kind == TERM_INTEGER || term->kind == TERM_NUMBER);
+}
+
+static B32 is_constant_term(Term* term) {
+  return is_numeric_term(term) || (term != NULL && term->kind == TERM_STRING);
+}
+
+static U64 list_length(Term* list) {
+  U64 count = 0;
+  for (Term* i = list; i->list.head && i->list.tail; i = i->list.tail) {
+    count++;
+  }
+  return count;
+}
+
+static Term* make_list(Context* context, Term** items, U64 count) {
+  Term* result = &context->nil;
+  for (U64 i = count; i > 0; i--) {
+    Term* new      = arena_allocate(&context->arena, Term, SITE_OPTIMIZER);
+    new->kind      = TERM_LIST;
+    new->list.head = items[i - 1];
+    new->list.tail = result;
+    result         = new;
+  }
+  return result;
+}
+
+static Values* bind_local(Context* context, Values* values, String name) {
+  Values* new = arena_allocate(&context->arena, Values, SITE_OPTIMIZER);
+  new->name   = name;
+  new->value  = NULL;
+  new->next   = values;
+  return new;
+}
+
+static Values* bind_parameters(Context* context, Values* values, Term* parameters) {
+  for (Term* i = parameters; i->list.head && i->list.tail; i = i->list.tail) {
+    if (i->list.head->kind == TERM_ATOM) {
+      values = bind_local(context, values, i->list.head->atom);
+    }
+  }
+  return values;
+}
+
+// Internal definitions extend the scope of the rest of a body, so every name
+// defined anywhere in the body is treated as local to all of it.
+static Values* bind_definitions(Context* context, Values* values, Term* body) {
+  for (Term* i = body; i->list.head && i->list.tail; i = i->list.tail) {
+    Term* form = i->list.head;
+    if (form->kind != TERM_LIST || !is_atom_named(form->list.head, string("define"))) {
+      continue;
+    }
+    Term* header = form->list.tail->list.head;
+    if (header != NULL && header->kind == TERM_ATOM) {
+      values = bind_local(context, values, header->atom);
+    } else if (header != NULL && header->kind == TERM_LIST && header->list.head != NULL) {
+      values = bind_local(context, values, header->list.head->atom);
+    }
+  }
+  return values;
+}
+
+static Term* find_built_in(Values* values, Term* term) {
+  if (term == NULL || term->kind != TERM_ATOM) {
+    return NULL;
+  }
+  Term* value = find_value(values, term->atom);
+  return value != NULL && value->kind == TERM_BUILT_IN ? value : NULL;
+}
+
+static B32 is_pure_built_in(BuiltInFn function) {
+  return function == built_in_add
+    || function == built_in_subtract
+    || function == built_in_multiply
+    || function == built_in_divide
+    || function == built_in_less_than
+    || function == built_in_equal
+    || function == built_in_greater_than
+    || function == built_in_not
+    || function == built_in_remainder
+    || function == built_in_sin
+    || function == built_in_cos
+    || function == built_in_log;
+}
+
+// Applies a pure built-in to literal operands at optimization time. Returns
+// NULL when the call cannot be folded, including the cases that would trap.
+static Term* fold_built_in(Context* context, Term* built_in, Term* operands) {
+  BuiltInFn function = built_ins[built_in->built_in];
+  if (!is_pure_built_in(function)) {
+    return NULL;
+  }
+
+  U64 count = list_length(operands);
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    if (!is_numeric_term(i->list.head)) {
+      return NULL;
+    }
+    B32 is_divisor = function == built_in_divide
+      ? i != operands
+      : function == built_in_remainder && i != operands;
+    if (is_divisor && i->list.head->kind == TERM_INTEGER && i->list.head->integer == 0) {
+      return NULL;
+    }
+  }
+
+  if (function == built_in_subtract || function == built_in_not ||
+      function == built_in_sin || function == built_in_cos || function == built_in_log) {
+    if (count < 1) {
+      return NULL;
+    }
+  } else if (function == built_in_less_than || function == built_in_equal ||
+	     function == built_in_greater_than || function == built_in_remainder) {
+    if (count < 2) {
+      return NULL;
+    }
+  }
+
+  return function(context, NULL, operands);
+}
+
+// Decides the truth of a test that does not depend on the environment.
+static B32 constant_truth(Context* context, Values* values, Term* test, B32* truth) {
+  if (is_constant_term(test)) {
+    *truth = true;
+    return true;
+  }
+  if (test == NULL || test->kind != TERM_LIST || test->list.head == NULL) {
+    return false;
+  }
+  Term* built_in = find_built_in(values, test->list.head);
+  if (built_in == NULL) {
+    return false;
+  }
+  Term* folded = fold_built_in(context, built_in, test->list.tail);
+  if (folded == NULL) {
+    return false;
+  }
+  *truth = !is_nil_term(folded);
+  return true;
+}
+
+// Counts the nodes of a body that may be inlined, or returns a number above
+// INLINE_LIMIT when the body refers to anything besides its parameters,
+// literals and built-ins that resolve identically at the call site.
+static U64 inline_cost(Values* site, Procedure* procedure, Term* term) {
+  if (term == NULL) {
+    return INLINE_LIMIT + 1;
+  }
+
+  switch (term->kind) {
+
+  case TERM_STRING:
+  case TERM_INTEGER:
+  case TERM_NUMBER:
+    return 1;
+
+  case TERM_ATOM: {
+    for (Term* i = procedure->parameters; i->list.head && i->list.tail; i = i->list.tail) {
+      if (strings_equal(i->list.head->atom, term->atom)) {
+	return 1;
+      }
+    }
+    Term* value = find_value(procedure->captured, term->atom);
+    if (value != NULL && value->kind == TERM_BUILT_IN && value == find_value(site, term->atom)) {
+      return 1;
+    }
+    return INLINE_LIMIT + 1;
+  }
+
+  case TERM_LIST: {
+    if (is_nil_term(term)) {
+      return INLINE_LIMIT + 1;
+    }
+    U64 cost = 0;
+    for (Term* i = term; i->list.head && i->list.tail && cost <= INLINE_LIMIT; i = i->list.tail) {
+      cost += inline_cost(site, procedure, i->list.head);
+    }
+    return cost;
+  }
+
+  default:
+    return INLINE_LIMIT + 1;
+  }
+}
+
+static Term* substitute(Context* context, Term* parameters, Term** arguments, Term* term) {
+  if (term->kind == TERM_ATOM) {
+    U64 index = 0;
+    for (Term* i = parameters; i->list.head && i->list.tail; i = i->list.tail) {
+      if (arguments[index] != NULL && strings_equal(i->list.head->atom, term->atom)) {
+	return arguments[index];
+      }
+      index++;
+    }
+    return term;
+  } else if (term->kind == TERM_LIST && !is_nil_term(term)) {
+    Term* new      = arena_allocate(&context->arena, Term, SITE_OPTIMIZER);
+    new->kind      = TERM_LIST;
+    new->list.head = substitute(context, parameters, arguments, term->list.head);
+    new->list.tail = substitute(context, parameters, arguments, term->list.tail);
+    return new;
+  } else {
+    return term;
+  }
+}
+
+// How many times "name" appears in "term".
+static U64 count_uses(Term* term, String name) {
+  if (term->kind == TERM_ATOM) {
+    return strings_equal(term->atom, name);
+  }
+  U64 uses = 0;
+  for (; term->kind == TERM_LIST && !is_nil_term(term); term = term->list.tail) {
+    uses += count_uses(term->list.head, name);
+  }
+  return uses;
+}
+
+// Whether evaluating "term" has no effect but its value: it is a literal, a
+// name or a call of a pure built-in on such terms.
+static B32 is_pure_term(Values* values, Term* term) {
+  if (is_constant_term(term) || term->kind == TERM_ATOM) {
+    return true;
+  }
+  if (term->kind != TERM_LIST || is_nil_term(term)) {
+    return false;
+  }
+  Term* built_in = find_built_in(values, term->list.head);
+  if (built_in == NULL || !is_pure_built_in(built_ins[built_in->built_in])) {
+    return false;
+  }
+  for (Term* i = term->list.tail; i->list.head && i->list.tail; i = i->list.tail) {
+    if (!is_pure_term(values, i->list.head)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static B32 mentions_parameter(Term* parameters, Term* term) {
+  for (Term* i = parameters; i->list.head && i->list.tail; i = i->list.tail) {
+    if (count_uses(term, i->list.head->atom) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static Term* optimize_term(Context* context, Values* values, Term* input);
+
+// Replaces a call to a small procedure with its body. The body only refers to
+// its parameters and built-ins, so an argument can be substituted into it
+// directly when it is a literal or a name, or when it is pure and used at most
+// once, which cannot change what the program computes. Anything else is bound
+// with a "let" so it is still evaluated exactly once, in order. Once there is
+// a "let", arguments that mention a parameter's name are bound too, so the
+// "let" cannot capture them.
+static Term* inline_procedure(Context* context, Values* values, Procedure* procedure, Term* operands) {
+  Term* body = procedure->body;
+  if (is_nil_term(body) || !is_nil_term(body->list.tail)) {
+    return NULL;
+  }
+  U64 count = list_length(procedure->parameters);
+  if (count != list_length(operands) || count > INLINE_LIMIT) {
+    return NULL;
+  }
+  if (inline_cost(values, procedure, body->list.head) > INLINE_LIMIT) {
+    return NULL;
+  }
+
+  Term* arguments[INLINE_LIMIT];
+  Term* bindings[INLINE_LIMIT];
+  B32   direct[INLINE_LIMIT];
+  B32   binding   = false;
+  U64   bound     = 0;
+  U64   index     = 0;
+  Term* parameter = procedure->parameters;
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    Term* argument = i->list.head;
+    direct[index]  = is_constant_term(argument) || argument->kind == TERM_ATOM ||
+      (is_pure_term(values, argument) && count_uses(body->list.head, parameter->list.head->atom) <= 1);
+    binding        = binding || !direct[index];
+    parameter      = parameter->list.tail;
+    index++;
+  }
+
+  index     = 0;
+  parameter = procedure->parameters;
+  for (Term* i = operands; i->list.head && i->list.tail; i = i->list.tail) {
+    Term* argument = i->list.head;
+    if (direct[index] && !(binding && mentions_parameter(procedure->parameters, argument))) {
+      arguments[index] = argument;
+    } else {
+      Term* pair[2]     = { parameter->list.head, argument };
+      bindings[bound++] = make_list(context, pair, 2);
+      arguments[index]  = NULL;
+    }
+    parameter = parameter->list.tail;
+    index++;
+  }
+
+  Term* result = substitute(context, procedure->parameters, arguments, body->list.head);
+  if (bound > 0) {
+    Term* let  = arena_allocate(&context->arena, Term, SITE_OPTIMIZER);
+    let->kind  = TERM_ATOM;
+    let->atom  = string("let");
+    Term* form[3] = { let, make_list(context, bindings, bound), result };
+    result        = make_list(context, form, 3);
+  }
+  return optimize_term(context, values, result);
+}
+
+static Term* optimize_body(Context* context, Values* values, Term* body) {
+  U64    count = list_length(body);
+  Term** forms = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_OPTIMIZER);
+  U64    index = 0;
+  for (Term* i = body; i->list.head && i->list.tail; i = i->list.tail) {
+    forms[index++] = optimize_term(context, values, i->list.head);
+  }
+  return make_list(context, forms, count);
+}
+
+static Term* optimize_term(Context* context, Values* values, Term* input) {
+  if (input == NULL) {
+    return input;
+  }
+
+  if (input->kind == TERM_ATOM) {
+    Term* value = find_value(values, input->atom);
+    return is_constant_term(value) ? value : input;
+  }
+
+  if (input->kind != TERM_LIST || is_nil_term(input)) {
+    return input;
+  }
+
+  Term* head = input->list.head;
+  Term* rest = input->list.tail;
+
+  if (is_atom_named(head, string("let"))) {
+    if (is_nil_term(rest) || is_nil_term(rest->list.tail)) {
+      return input;
+    }
+    U64    count    = list_length(rest->list.head);
+    Term** bindings = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_OPTIMIZER);
+    Values* scope   = values;
+    U64    index    = 0;
+    for (Term* i = rest->list.head; i->list.head && i->list.tail; i = i->list.tail) {
+      Term* binding = i->list.head;
+      if (binding->kind != TERM_LIST || list_length(binding) < 2 ||
+	  binding->list.head->kind != TERM_ATOM) {
+	return input;
+      }
+      Term* pair[2] = {
+	binding->list.head,
+	optimize_term(context, values, binding->list.tail->list.head),
+      };
+      bindings[index++] = make_list(context, pair, 2);
+      scope             = bind_local(context, scope, binding->list.head->atom);
+    }
+    Term* form[3] = {
+      head,
+      make_list(context, bindings, count),
+      optimize_term(context, scope, rest->list.tail->list.head),
+    };
+    return make_list(context, form, 3);
+  }
+
+  if (is_atom_named(head, string("lambda"))) {
+    if (is_nil_term(rest) || rest->list.head->kind != TERM_LIST) {
+      return input;
+    }
+    Values* scope = bind_parameters(context, values, rest->list.head);
+    scope         = bind_definitions(context, scope, rest->list.tail);
+    Term* form[2] = { head, rest->list.head };
+    Term* result  = make_list(context, form, 2);
+    result->list.tail->list.tail = optimize_body(context, scope, rest->list.tail);
+    return result;
+  }
+
+  if (is_atom_named(head, string("define"))) {
+    if (is_nil_term(rest)) {
+      return input;
+    }
+    Term* header = rest->list.head;
+    Term* form[2] = { head, header };
+    Term* result  = make_list(context, form, 2);
+    if (header->kind == TERM_LIST && !is_nil_term(header)) {
+      Values* scope = bind_local(context, values, header->list.head->atom);
+      scope         = bind_parameters(context, scope, header->list.tail);
+      scope         = bind_definitions(context, scope, rest->list.tail);
+      result->list.tail->list.tail = optimize_body(context, scope, rest->list.tail);
+    } else {
+      result->list.tail->list.tail = optimize_body(context, values, rest->list.tail);
+    }
+    return result;
+  }
+
+  Term* operator = head->kind == TERM_ATOM ? find_value(values, head->atom) : NULL;
+
+  if (operator != NULL && operator->kind == TERM_BUILT_IN) {
+    BuiltInFn function = built_ins[operator->built_in];
+    if (function == built_in_if && list_length(rest) >= 2) {
+      B32 truth;
+      if (constant_truth(context, values, optimize_term(context, values, rest->list.head), &truth)) {
+	if (truth) {
+	  return optimize_term(context, values, rest->list.tail->list.head);
+	} else if (!is_nil_term(rest->list.tail->list.tail)) {
+	  return optimize_term(context, values, rest->list.tail->list.tail->list.head);
+	}
+      }
+    } else if (function == built_in_cond) {
+      U64    count   = list_length(rest);
+      Term** clauses = (Term**) arena_allocate_bytes(&context->arena, count * sizeof(Term*), _Alignof(Term*), SITE_OPTIMIZER);
+      U64    kept    = 0;
+      for (Term* i = rest; i->list.head && i->list.tail; i = i->list.tail) {
+	Term* clause = i->list.head;
+	if (clause->kind != TERM_LIST || list_length(clause) < 2) {
+	  clauses[kept++] = clause;
+	  continue;
+	}
+	Term* test = optimize_term(context, values, clause->list.head);
+	B32   truth;
+	if (constant_truth(context, values, test, &truth)) {
+	  if (!truth) {
+	    continue;
+	  }
+	  Term* value = optimize_term(context, values, clause->list.tail->list.head);
+	  if (kept == 0) {
+	    return value;
+	  }
+	  Term* pair[2]   = { test, value };
+	  clauses[kept++] = make_list(context, pair, 2);
+	  break;
+	}
+	Term* pair[2]   = { test, optimize_term(context, values, clause->list.tail->list.head) };
+	clauses[kept++] = make_list(context, pair, 2);
+      }
+      Term* result     = make_list(context, &head, 1);
+      result->list.tail = make_list(context, clauses, kept);
+      return result;
+    }
+  }
+
+  Term* result = make_list(context, &head, 1);
+  result->list.head = optimize_term(context, values, head);
+  result->list.tail = optimize_body(context, values, rest);
+
+  if (operator != NULL && operator->kind == TERM_BUILT_IN) {
+    Term* folded = fold_built_in(context, operator, result->list.tail);
+    if (folded != NULL && is_numeric_term(folded)) {
+      return folded;
+    }
+  } else if (operator != NULL && operator->kind == TERM_PROCEDURE) {
+    Term* inlined = inline_procedure(context, values, &operator->procedure, result->list.tail);
+    if (inlined != NULL) {
+      return inlined;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,294 @@
+// A precompiled program holds the parsed forms of a source file laid out so
+// that loading it takes one mmap and a pass that turns offsets into pointers,
+// with no lexing or parsing.
+//
+// The file is a PrecompiledHeader, then the file offset of each form, then
+// the terms of every form, then the bytes of every atom and string, each
+// distinct one stored once. Every pointer inside a stored term is an offset
+// from the start of the file, or 0 for NULL.
+//
+// With "--cache", the precompiled form of "path" is kept in "path.vlc" and
+// used as long as the size and hash of the source match its header and the
+// rest of the file matches the hash stored with them. Any other file is
+// rebuilt.
+
+#define PRECOMPILED_MAGIC   0x31434c5053494c56ull
+#define PRECOMPILED_VERSION 2
+
+typedef struct {
+  U64 magic;
+  U64 version;
+  U64 term_size;
+  U64 source_size;
+  U64 source_hash;
+  U64 form_count;
+  U64 forms;
+  U64 terms;
+  U64 term_count;
+  U64 symbols;
+  U64 symbols_size;
+  U64 image_hash;
+} PrecompiledHeader;
+
+typedef struct {
+  Arena* arena;
+  Term*  terms;
+  U64    term_count;
+  U8*    symbols;
+  U64    symbols_size;
+  Table* interned;
+  U64    terms_offset;
+  U64    symbols_offset;
+} Precompiler;
+
+static void count_terms(Term* term, U64* terms, U64* bytes) {
+  for (; term != NULL; term = term->list.tail) {
+    (*terms)++;
+    if (term->kind == TERM_ATOM || term->kind == TERM_STRING) {
+      *bytes += term->atom.size;
+    }
+    if (term->kind != TERM_LIST) {
+      return;
+    }
+    count_terms(term->list.head, terms, bytes);
+  }
+}
+
+// Returns the file offset of the bytes of "text", storing them on first use.
+static U8* intern(Precompiler* precompiler, String text) {
+  Term* key   = arena_allocate(precompiler->arena, Term, SITE_OTHER);
+  key->kind   = TERM_STRING;
+  key->string = text;
+
+  Term* found = table_get(precompiler->interned, key);
+  if (found != NULL) {
+    return (U8*) found->integer;
+  }
+  U64 offset = precompiler->symbols_offset + precompiler->symbols_size;
+  memcpy(&precompiler->symbols[precompiler->symbols_size], text.data, text.size);
+  precompiler->symbols_size += text.size;
+
+  Term* value    = arena_allocate(precompiler->arena, Term, SITE_OTHER);
+  value->kind    = TERM_INTEGER;
+  value->integer = offset;
+  table_set(precompiler->arena, precompiler->interned, key, value);
+  return (U8*) offset;
+}
+
+// Copies a term into the term array and returns its file offset. The cells of
+// a list are stored one after another rather than by recursing down the tail.
+static Term* precompile_term(Precompiler* precompiler, Term* term) {
+  Term*  first = NULL;
+  Term** link  = &first;
+  for (; term != NULL; term = term->list.tail) {
+    U64   index = precompiler->term_count++;
+    Term* slot  = &precompiler->terms[index];
+    *slot       = *term;
+    *link       = (Term*) (precompiler->terms_offset + index * sizeof(Term));
+
+    if (term->kind == TERM_ATOM || term->kind == TERM_STRING) {
+      slot->atom.data = intern(precompiler, term->atom);
+    }
+    if (term->kind != TERM_LIST) {
+      return first;
+    }
+    slot->list.head = precompile_term(precompiler, term->list.head);
+    slot->list.tail = NULL;
+    link            = &slot->list.tail;
+  }
+  return first;
+}
+
+static B32 write_all(int fd, U8* data, U64 size) {
+  for (U64 written = 0; written < size;) {
+    I64 count = write(fd, &data[written], size - written);
+    if (count <= 0) {
+      return false;
+    }
+    written += count;
+  }
+  return true;
+}
+
+// Parses "source" in a scratch arena and writes it to "path". The file is
+// written under a temporary name and renamed, so a reader never sees half
+// of it. Returns false if it could not be written.
+static B32 precompile(String source, char* path) {
+  Arena arena;
+  arena_initialize(&arena, 1ull << 36);
+
+  U64    form_count = 0;
+  Term*  forms      = NULL;
+  Term** last       = &forms;
+  for (String input = clear_blanks(source); input.size > 0; input = clear_blanks(input)) {
+    ParseResult parsed = parse(&arena, input);
+    input              = parsed.rest;
+    Term* new          = arena_allocate(&arena, Term, SITE_OTHER);
+    new->kind          = TERM_LIST;
+    new->list.head     = parsed.term;
+    new->list.tail     = NULL;
+    *last              = new;
+    last               = &new->list.tail;
+    form_count++;
+  }
+
+  U64 term_count = 0;
+  U64 bytes      = 0;
+  for (Term* i = forms; i != NULL; i = i->list.tail) {
+    count_terms(i->list.head, &term_count, &bytes);
+  }
+
+  PrecompiledHeader header;
+  header.magic        = PRECOMPILED_MAGIC;
+  header.version      = PRECOMPILED_VERSION;
+  header.term_size    = sizeof(Term);
+  header.source_size  = source.size;
+  header.source_hash  = hash_bytes(source.data, source.size);
+  header.form_count   = form_count;
+  header.forms        = sizeof header;
+  header.terms        = header.forms + form_count * sizeof(U64);
+  header.term_count   = term_count;
+  header.symbols      = header.terms + term_count * sizeof(Term);
+
+  // Everything after the header is built in one buffer so it can be hashed.
+  U8* image = arena_allocate_bytes(&arena, header.symbols - header.forms + bytes, _Alignof(Term), SITE_OTHER);
+
+  Precompiler precompiler;
+  precompiler.arena          = &arena;
+  precompiler.terms          = (Term*) &image[header.terms - header.forms];
+  precompiler.term_count     = 0;
+  precompiler.symbols        = &image[header.symbols - header.forms];
+  precompiler.symbols_size   = 0;
+  precompiler.interned       = table_create(&arena);
+  precompiler.terms_offset   = header.terms;
+  precompiler.symbols_offset = header.symbols;
+
+  U64* offsets = (U64*) image;
+  U64  index   = 0;
+  for (Term* i = forms; i != NULL; i = i->list.tail) {
+    offsets[index++] = (U64) precompile_term(&precompiler, i->list.head);
+  }
+  header.symbols_size = precompiler.symbols_size;
+  header.image_hash   = hash_bytes(image, header.symbols + header.symbols_size - header.forms);
+
+  U64   size      = strlen(path);
+  char* temporary = (char*) arena_allocate_bytes(&arena, size + 5, 1, SITE_OTHER);
+  memcpy(temporary, path, size);
+  memcpy(&temporary[size], ".tmp", 5);
+
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  B32 written = fd != -1
+    && write_all(fd, (U8*) &header, sizeof header)
+    && write_all(fd, image, header.symbols + header.symbols_size - header.forms);
+  if (fd != -1) {
+    close(fd);
+  }
+  written = written && rename(temporary, path) == 0;
+  if (!written) {
+    unlink(temporary);
+  }
+
+  munmap(arena.memory, arena.capacity);
+  return written;
+}
+
+// Whether "offset" is 0 or the offset of a term stored after "after". The
+// cells of a list and their heads are always stored after the cell that
+// points to them, so a damaged file cannot make a list loop back on itself.
+static B32 term_offset_valid(PrecompiledHeader* header, U64 offset, U64 after) {
+  return offset == 0
+    || (offset > after && offset >= header->terms && offset < header->symbols
+	&& (offset - header->terms) % sizeof(Term) == 0);
+}
+
+// Maps "path" and turns it back into terms, or returns NULL if it is missing,
+// damaged or was made from a different source. The mapping is private, so
+// the relocation never reaches the file, and it stays for the life of the
+// process since atoms and procedure bodies point into it.
+static Term** precompiled_load(char* path, String source, U64* form_count) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  struct stat info;
+  B32 valid = fstat(fd, &info) == 0 && (U64) info.st_size >= sizeof(PrecompiledHeader);
+  U8* base  = valid ? mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+
+  U64                size   = info.st_size;
+  PrecompiledHeader* header = (PrecompiledHeader*) base;
+  valid = header->magic == PRECOMPILED_MAGIC
+    && header->version == PRECOMPILED_VERSION
+    && header->term_size == sizeof(Term)
+    && header->source_size == source.size
+    && header->form_count <= size / sizeof(U64)
+    && header->term_count <= size / sizeof(Term)
+    && header->symbols_size <= size
+    && header->forms == sizeof *header
+    && header->terms == header->forms + header->form_count * sizeof(U64)
+    && header->symbols == header->terms + header->term_count * sizeof(Term)
+    && header->symbols + header->symbols_size == size
+    && header->source_hash == hash_bytes(source.data, source.size)
+    && header->image_hash == hash_bytes(&base[header->forms], size - header->forms);
+
+  Term* terms = (Term*) &base[header->terms];
+  for (U64 i = 0; valid && i < header->term_count; i++) {
+    Term* term   = &terms[i];
+    U64   offset = header->terms + i * sizeof(Term);
+    if (term->kind == TERM_LIST) {
+      U64 head = (U64) term->list.head;
+      U64 tail = (U64) term->list.tail;
+      valid    = term_offset_valid(header, head, offset) && term_offset_valid(header, tail, offset);
+      term->list.head = head == 0 ? NULL : (Term*) &base[head];
+      term->list.tail = tail == 0 ? NULL : (Term*) &base[tail];
+    } else if (term->kind == TERM_ATOM || term->kind == TERM_STRING) {
+      U64 data = (U64) term->atom.data;
+      valid    = data >= header->symbols && data <= size && term->atom.size <= size - data;
+      term->atom.data = &base[data];
+    } else {
+      valid = term->kind == TERM_INTEGER || term->kind == TERM_NUMBER;
+    }
+  }
+
+  // Offsets and pointers are the same size, so the form table is rewritten in
+  // place.
+  Term** forms = (Term**) &base[header->forms];
+  for (U64 i = 0; valid && i < header->form_count; i++) {
+    U64 offset = (U64) forms[i];
+    valid      = offset != 0 && term_offset_valid(header, offset, 0);
+    forms[i]   = (Term*) &base[offset];
+  }
+  if (!valid) {
+    munmap(base, size);
+    return NULL;
+  }
+  *form_count = header->form_count;
+  return forms;
+}
+
+// Evaluates the program in "path", whose text is "source", from its
+// precompiled form, creating that first when it is missing or stale. If the
+// cache cannot be written the source is evaluated directly.
+static void evaluate_cached(Context* context, char* path, String source, B32 optimize) {
+  U64   size  = strlen(path);
+  char* cache = (char*) arena_allocate_bytes(&context->arena, size + 5, 1, SITE_OTHER);
+  memcpy(cache, path, size);
+  memcpy(&cache[size], ".vlc", 5);
+
+  U64    form_count = 0;
+  Term** forms      = precompiled_load(cache, source, &form_count);
+  if (forms == NULL && precompile(source, cache)) {
+    forms = precompiled_load(cache, source, &form_count);
+  }
+  if (forms == NULL) {
+    evaluate_program(context, source, optimize);
+    return;
+  }
+
+  for (U64 form = 0; form < form_count; form++) {
+    evaluate_form(context, form, forms[form], arena_mark(&context->arena), optimize);
+  }
+}
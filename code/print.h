@@ -1,35 +1,199 @@
-static U8  print_buffer[4096];
-static U64 print_buffered;
+// Output is buffered per interpreter. A full buffer is handed to "sink" when
+// one is set, otherwise it is written to "fd".
+//
+// With a writer, the buffer is one of OUTPUT_BLOCKS blocks of "capacity"
+// bytes. A full block is queued and printing goes on in the next one while a
+// thread writes everything queued with one writev. Only "flush" waits for
+// the queue to drain, so output is complete whenever it returns.
+typedef void (*OutputFn)(void* user, U8* data, U64 size);
 
-static void flush() {
-  if (print_buffered > 0) {
-    write(STDOUT_FILENO, print_buffer, print_buffered);
-    print_buffered = 0;
+#define OUTPUT_BUFFER (64ull << 10)
+#define OUTPUT_BLOCKS 8
+
+typedef struct {
+  U8*             blocks;
+  U64             first;
+  U64             count;
+  U64             sizes[OUTPUT_BLOCKS];
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  changed;
+} OutputWriter;
+
+typedef struct {
+  U8*           buffer;
+  U64           capacity;
+  U64           buffered;
+  int           fd;
+  OutputFn      sink;
+  void*         user;
+  OutputWriter* writer;
+} Output;
+
+static U8* output_map(U64 size) {
+  U8* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(memory != MAP_FAILED);
+  return memory;
+}
+
+static void output_initialize(Output* output, int fd, OutputFn sink, void* user) {
+  output->buffer   = output_map(OUTPUT_BUFFER);
+  output->capacity = OUTPUT_BUFFER;
+  output->buffered = 0;
+  output->fd       = fd;
+  output->sink     = sink;
+  output->user     = user;
+  output->writer   = NULL;
+}
+
+// A write interrupted by a signal is retried. Any other error, such as a
+// closed pipe or a full disk, would lose the output, so it is fatal.
+static void output_write(Output* output, U8* data, U64 size) {
+  if (output->sink != NULL) {
+    output->sink(output->user, data, size);
+    return;
+  }
+  for (U64 written = 0; written < size;) {
+    I64 count = write(output->fd, &data[written], size - written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    assert(count > 0);
+    written += count;
+  }
+}
+
+#ifdef VLISP_COMMAND
+static void* output_writer_run(void* argument) {
+  Output*       output = argument;
+  OutputWriter* writer = output->writer;
+  struct iovec  pieces[OUTPUT_BLOCKS];
+
+  pthread_mutex_lock(&writer->lock);
+  while (true) {
+    while (writer->count == 0) {
+      pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    U64 first = writer->first;
+    U64 count = writer->count;
+    for (U64 i = 0; i < count; i++) {
+      U64 block = (first + i) % OUTPUT_BLOCKS;
+      pieces[i].iov_base = &writer->blocks[block * output->capacity];
+      pieces[i].iov_len  = writer->sizes[block];
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    // The blocks being written are never the one being filled. Errors are
+    // handled as output_write handles them.
+    struct iovec* piece = pieces;
+    U64           left  = count;
+    while (left > 0) {
+      I64 written = writev(output->fd, piece, left);
+      if (written < 0 && errno == EINTR) {
+	continue;
+      }
+      assert(written > 0);
+      for (; left > 0 && (U64) written >= piece->iov_len; piece++, left--) {
+	written -= piece->iov_len;
+      }
+      if (left > 0) {
+	piece->iov_base  = (U8*) piece->iov_base + written;
+	piece->iov_len  -= written;
+      }
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->first  = (first + count) % OUTPUT_BLOCKS;
+    writer->count -= count;
+    pthread_cond_broadcast(&writer->changed);
+  }
+  return NULL;
+}
+
+// Makes the buffer "capacity" bytes, and starts a writer thread if
+// "threaded" is set. Any output buffered so far is written first.
+static void output_configure(Output* output, U64 capacity, B32 threaded) {
+  assert(output->writer == NULL && capacity > 0);
+  output_write(output, output->buffer, output->buffered);
+  munmap(output->buffer, output->capacity);
+  output->capacity = capacity;
+  output->buffered = 0;
+  if (!threaded || output->sink != NULL) {
+    output->buffer = output_map(capacity);
+    return;
+  }
+
+  OutputWriter* writer = (OutputWriter*) output_map(sizeof(OutputWriter));
+  writer->blocks = output_map(capacity * OUTPUT_BLOCKS);
+  writer->first  = 0;
+  writer->count  = 0;
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->changed, NULL);
+  output->writer = writer;
+  output->buffer = writer->blocks;
+  assert(pthread_create(&writer->thread, NULL, output_writer_run, output) == 0);
+}
+#endif
+
+// Hands the buffer over to be written and starts on an empty one.
+static void output_submit(Output* output) {
+  OutputWriter* writer = output->writer;
+  if (writer == NULL) {
+    output_write(output, output->buffer, output->buffered);
+    output->buffered = 0;
+    return;
+  }
+  pthread_mutex_lock(&writer->lock);
+  U64 block = (writer->first + writer->count) % OUTPUT_BLOCKS;
+  writer->sizes[block] = output->buffered;
+  writer->count++;
+  pthread_cond_broadcast(&writer->changed);
+  while (writer->count == OUTPUT_BLOCKS) {
+    pthread_cond_wait(&writer->changed, &writer->lock);
+  }
+  block = (writer->first + writer->count) % OUTPUT_BLOCKS;
+  pthread_mutex_unlock(&writer->lock);
+
+  output->buffer   = &writer->blocks[block * output->capacity];
+  output->buffered = 0;
+}
+
+static void flush(Output* output) {
+  if (output->buffered > 0) {
+    output_submit(output);
+  }
+  OutputWriter* writer = output->writer;
+  if (writer != NULL) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->count > 0) {
+      pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
   }
 }
 
-static void print(String message) {
-  if (message.size > sizeof print_buffer) {
-    flush();
-    write(STDOUT_FILENO, message.data, message.size);
+static void print(Output* output, String message) {
+  if (message.size > output->capacity) {
+    flush(output);
+    output_write(output, message.data, message.size);
   } else {
-    if (message.size > sizeof print_buffer - print_buffered) {
-      flush();
+    if (message.size > output->capacity - output->buffered) {
+      output_submit(output);
     }
-    memcpy(&print_buffer[print_buffered], message.data, message.size);
-    print_buffered += message.size;
+    memcpy(&output->buffer[output->buffered], message.data, message.size);
+    output->buffered += message.size;
   }
 }
 
-static void print_char(U8 c) {
-  if (print_buffered == sizeof print_buffer) {
-    flush();
+static void print_char(Output* output, U8 c) {
+  if (output->buffered == output->capacity) {
+    output_submit(output);
   }
-  print_buffer[print_buffered] = c;
-  print_buffered++;
+  output->buffer[output->buffered] = c;
+  output->buffered++;
 }
 
-static void print_int(I64 n) {
+static void print_int(Output* output, I64 n) {
   U8  buffer[32];
   U8* end      = &buffer[sizeof buffer];
   U8* out      = end;
@@ -53,33 +217,33 @@ static void print_int(I64 n) {
   String message;
   message.data = out;
   message.size = end - out;
-  print(message);
+  print(output, message);
 }
 
-static void print_float(F64 n) {
-  if (n == NAN) {
-    print(string("nan"));
+static void print_float(Output* output, F64 n) {
+  if (isnan(n)) {
+    print(output, string("nan"));
     return;
   }
-  if (n == INFINITY) {
-    print(string("inf"));
-    return;
-  }
-  
+
   U8  buffer[6];
   U8* end = &buffer[sizeof buffer];
   U8* out = buffer;
 
   if (n < 0) {
     n = -n;
-    print_char('-');
+    print_char(output, '-');
+  }
+  if (isinf(n)) {
+    print(output, string("inf"));
+    return;
   }
 
-  print_int(n);
+  print_int(output, n);
 
   n -= floor(n);
 
-  print_char('.');
+  print_char(output, '.');
 
   do {
     n *= 10;
@@ -91,5 +255,5 @@ static void print_float(F64 n) {
   String message;
   message.data = buffer;
   message.size = out - buffer;
-  print(message);
+  print(output, message);
 }
@@ -0,0 +1,168 @@
+// The heap profiler attributes every arena allocation to the kind of thing
+// being allocated and to the procedure running at the time. Totals are
+// cumulative, so memory later released by arena_restore still counts; the
+// snapshots also show how much of the arena is in use.
+
+typedef enum {
+  SITE_PARSER,
+  SITE_STRING,
+  SITE_ENVIRONMENT,
+  SITE_VALUE,
+  SITE_ARITHMETIC,
+  SITE_CLOSURE,
+  SITE_OPTIMIZER,
+  SITE_TABLE,
+  SITE_VECTOR,
+  SITE_STREAM,
+  SITE_LIST,
+  SITE_OTHER,
+  SITE_COUNT,
+} AllocationSite;
+
+static const String site_names[SITE_COUNT] = {
+  string("parser"),
+  string("string literal"),
+  string("environment"),
+  string("value copy"),
+  string("arithmetic"),
+  string("closure"),
+  string("optimizer"),
+  string("table"),
+  string("vector"),
+  string("stream"),
+  string("list"),
+  string("other"),
+};
+
+typedef struct {
+  String name;
+  U64    bytes;
+  U64    count;
+} ProfileEntry;
+
+#define PROFILE_PROCEDURES 4096
+#define PROFILE_NAMES      (PROFILE_PROCEDURES / 4 * 3)
+
+// Allocations made outside any procedure, and those made by procedures that
+// found the table full.
+static const String profile_top_level = string("<top level>");
+static const String profile_other     = string("<other>");
+
+typedef struct {
+  U64           bytes[SITE_COUNT];
+  U64           count[SITE_COUNT];
+  ProfileEntry  procedures[PROFILE_PROCEDURES];
+  U64           procedure_count;
+  // The used entries, largest first, as of the last report.
+  ProfileEntry* sorted[PROFILE_PROCEDURES];
+  String        procedure;
+  U64           total;
+  U64           interval;
+  U64           next_snapshot;
+  Output        output;
+} Profile;
+
+#ifdef VLISP_COMMAND
+static Profile* profile_create(U64 interval) {
+  Profile* profile = mmap(NULL, sizeof(Profile), PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(profile != MAP_FAILED);
+  profile->procedure     = profile_top_level;
+  profile->interval      = interval;
+  profile->next_snapshot = interval;
+  output_initialize(&profile->output, STDERR_FILENO, NULL, NULL);
+  return profile;
+}
+#endif
+
+static void print_profile_line(Output* output, String name, U64 bytes, U64 count) {
+  print(output, string("  "));
+  print(output, name);
+  for (U64 i = name.size; i < 24; i++) {
+    print_char(output, ' ');
+  }
+  print_int(output, bytes);
+  print(output, string(" bytes in "));
+  print_int(output, count);
+  print(output, string(" objects\n"));
+}
+
+static void profile_snapshot(Profile* profile, U64 live) {
+  Output* output = &profile->output;
+  print(output, string("heap snapshot: "));
+  print_int(output, profile->total);
+  print(output, string(" bytes allocated, "));
+  print_int(output, live);
+  print(output, string(" live\n"));
+  for (U64 i = 0; i < SITE_COUNT; i++) {
+    if (profile->count[i] > 0) {
+      print_profile_line(output, site_names[i], profile->bytes[i], profile->count[i]);
+    }
+  }
+  flush(output);
+}
+
+// Finds the entry for "name", adding it if there is room. The table is only
+// filled to PROFILE_NAMES, so a search always ends at a free slot soon; any
+// name that finds it that full counts against "<other>" instead.
+static ProfileEntry* profile_entry(Profile* profile, String name) {
+  U64 index = hash_bytes(name.data, name.size) % PROFILE_PROCEDURES;
+  while (true) {
+    ProfileEntry* entry = &profile->procedures[index];
+    if (entry->name.data == NULL) {
+      if (profile->procedure_count >= PROFILE_NAMES && !strings_equal(name, profile_other)) {
+	return profile_entry(profile, profile_other);
+      }
+      entry->name = name;
+      profile->procedure_count++;
+      return entry;
+    }
+    if (strings_equal(entry->name, name)) {
+      return entry;
+    }
+    index = (index + 1) % PROFILE_PROCEDURES;
+  }
+}
+
+static void profile_record(Profile* profile, AllocationSite site, U64 size, U64 live) {
+  profile->bytes[site] += size;
+  profile->count[site] += 1;
+  profile->total       += size;
+
+  ProfileEntry* entry = profile_entry(profile, profile->procedure);
+  entry->bytes += size;
+  entry->count += 1;
+
+  if (profile->interval > 0 && profile->total >= profile->next_snapshot) {
+    profile->next_snapshot = profile->total + profile->interval;
+    profile_snapshot(profile, live);
+  }
+}
+
+static int compare_profile_entries(const void* a, const void* b) {
+  U64 left  = (*(ProfileEntry**) a)->bytes;
+  U64 right = (*(ProfileEntry**) b)->bytes;
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void profile_report(Profile* profile, U64 live) {
+  profile_snapshot(profile, live);
+
+  // A report can be followed by more allocations, as after an error in an
+  // embedding or in watch mode, so the table itself stays in hash order.
+  U64 count = 0;
+  for (U64 i = 0; i < PROFILE_PROCEDURES; i++) {
+    if (profile->procedures[i].name.data != NULL) {
+      profile->sorted[count++] = &profile->procedures[i];
+    }
+  }
+  qsort(profile->sorted, count, sizeof(ProfileEntry*), compare_profile_entries);
+
+  Output* output = &profile->output;
+  print(output, string("by procedure:\n"));
+  for (U64 i = 0; i < count; i++) {
+    ProfileEntry* entry = profile->sorted[i];
+    print_profile_line(output, entry->name, entry->bytes, entry->count);
+  }
+  flush(output);
+}
@@ -0,0 +1,86 @@
+// A server keeps one interpreter with its prelude already evaluated and
+// answers requests on a Unix domain socket. A client sends a program and shuts
+// down its side of the connection; the server forks, so the request runs in a
+// copy of the warm interpreter that cannot affect later requests, and
+// everything the program prints is written back over the connection.
+
+static int open_socket(char* path, struct sockaddr_un* address) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(fd != -1);
+
+  U64 size = strlen(path);
+  assert(size < sizeof address->sun_path);
+  memset(address, 0, sizeof *address);
+  address->sun_family = AF_UNIX;
+  memcpy(address->sun_path, path, size);
+  return fd;
+}
+
+static void serve_request(Context* context, int connection, B32 optimize) {
+  context_seed(context, time(NULL) ^ getpid());
+
+  String input = read_all(&context->arena, connection);
+  assert(dup2(connection, STDOUT_FILENO) != -1);
+  close(connection);
+
+  if (context->arena.governor != NULL) {
+    governor_start(context->arena.governor);
+  }
+  evaluate_program(context, input, optimize);
+  flush(&context->output);
+}
+
+static void serve(Context* context, char* path, B32 optimize) {
+  struct sockaddr_un address;
+  int listener = open_socket(path, &address);
+  unlink(path);
+  assert(bind(listener, (struct sockaddr*) &address, sizeof address) == 0);
+  assert(listen(listener, SOMAXCONN) == 0);
+
+  // Finished requests are reaped by the kernel.
+  signal(SIGCHLD, SIG_IGN);
+  flush(&context->output);
+
+  while (true) {
+    int connection = accept(listener, NULL, NULL);
+    if (connection == -1) {
+      continue;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+      close(listener);
+      serve_request(context, connection, optimize);
+      exit(EXIT_SUCCESS);
+    }
+    close(connection);
+  }
+}
+
+static void connect_and_send(Context* context, char* path, String program) {
+  struct sockaddr_un address;
+  int connection = open_socket(path, &address);
+  if (connect(connection, (struct sockaddr*) &address, sizeof address) != 0) {
+    print(&context->output, string("Could not connect to "));
+    print(&context->output, string(path));
+    print(&context->output, string(".\n"));
+    fail(context);
+  }
+
+  for (U64 sent = 0; sent < program.size;) {
+    I64 count = write(connection, &program.data[sent], program.size - sent);
+    assert(count > 0);
+    sent += count;
+  }
+  shutdown(connection, SHUT_WR);
+
+  U8 buffer[65536];
+  while (true) {
+    I64 count = read(connection, buffer, sizeof buffer);
+    assert(count >= 0);
+    if (count == 0) {
+      break;
+    }
+    print(&context->output, (String) { .data = buffer, .size = count });
+  }
+}
@@ -0,0 +1,201 @@
+// Hash tables with open addressing and linear probing. Keys are integers,
+// numbers, atoms or strings, hashed and compared by value.
+//
+// When a table fills up it allocates a larger slot array but keeps the old one
+// around, moving TABLE_MIGRATE old slots across on every later operation, so
+// no single operation pays for rehashing the whole table. Until the move is
+// done, lookups check both arrays.
+
+#define TABLE_MINIMUM 8
+#define TABLE_MIGRATE 16
+
+// An empty slot has no key. A deleted slot keeps its key but has no value, so
+// probing continues past it.
+typedef struct {
+  Term* key;
+  Term* value;
+  U64   hash;
+} TableSlot;
+
+struct Table {
+  TableSlot* slots;
+  U64        capacity;
+  U64        used;
+  U64        count;
+
+  TableSlot* old;
+  U64        old_capacity;
+  U64        migrated;
+};
+
+static B32 is_hashable_term(Term* term) {
+  return term->kind == TERM_INTEGER || term->kind == TERM_NUMBER
+    || term->kind == TERM_ATOM || term->kind == TERM_STRING;
+}
+
+static U64 hash_term(Term* term) {
+  switch (term->kind) {
+  case TERM_INTEGER:
+    return hash_bytes((U8*) &term->integer, sizeof term->integer) ^ TERM_INTEGER;
+  case TERM_NUMBER: {
+    F64 number = term->number == 0 ? 0 : term->number;
+    return hash_bytes((U8*) &number, sizeof number) ^ TERM_NUMBER;
+  }
+  case TERM_ATOM:
+    return hash_bytes(term->atom.data, term->atom.size) ^ TERM_ATOM;
+  default:
+    assert(term->kind == TERM_STRING);
+    return hash_bytes(term->string.data, term->string.size) ^ TERM_STRING;
+  }
+}
+
+static B32 keys_equal(Term* a, Term* b) {
+  if (a->kind != b->kind) {
+    return false;
+  }
+  switch (a->kind) {
+  case TERM_INTEGER:
+    return a->integer == b->integer;
+  case TERM_NUMBER:
+    return a->number == b->number;
+  case TERM_ATOM:
+    return strings_equal(a->atom, b->atom);
+  default:
+    assert(a->kind == TERM_STRING);
+    return strings_equal(a->string, b->string);
+  }
+}
+
+static TableSlot* allocate_slots(Arena* arena, U64 capacity) {
+  U64        size  = capacity * sizeof(TableSlot);
+  TableSlot* slots = (TableSlot*) arena_allocate_bytes(arena, size, _Alignof(TableSlot), SITE_TABLE);
+  memset(slots, 0, size);
+  return slots;
+}
+
+static Table* table_create(Arena* arena) {
+  Table* table        = arena_allocate(arena, Table, SITE_TABLE);
+  table->slots        = allocate_slots(arena, TABLE_MINIMUM);
+  table->capacity     = TABLE_MINIMUM;
+  table->used         = 0;
+  table->count        = 0;
+  table->old          = NULL;
+  table->old_capacity = 0;
+  table->migrated     = 0;
+  return table;
+}
+
+// Returns the live slot holding "key", or the empty slot where it belongs.
+static TableSlot* probe(TableSlot* slots, U64 capacity, Term* key, U64 hash) {
+  U64 index = hash & (capacity - 1);
+  while (true) {
+    TableSlot* slot = &slots[index];
+    if (slot->key == NULL) {
+      return slot;
+    }
+    if (slot->value != NULL && slot->hash == hash && keys_equal(slot->key, key)) {
+      return slot;
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void table_migrate(Table* table, U64 budget) {
+  if (table->old == NULL) {
+    return;
+  }
+  for (; budget > 0 && table->migrated < table->old_capacity; budget--) {
+    TableSlot* from = &table->old[table->migrated];
+    table->migrated++;
+    if (from->key == NULL || from->value == NULL) {
+      continue;
+    }
+    TableSlot* to = probe(table->slots, table->capacity, from->key, from->hash);
+    assert(to->key == NULL);
+    *to = *from;
+    table->used++;
+    // Deleted, so that lookups in the old array no longer find it.
+    from->value = NULL;
+  }
+  if (table->migrated == table->old_capacity) {
+    table->old = NULL;
+  }
+}
+
+// Starts moving to a fresh slot array once three quarters of the current one
+// is used, including deleted slots. A table that is mostly deleted slots is
+// rebuilt at the same size.
+static void table_reserve(Arena* arena, Table* table) {
+  if ((table->used + 1) * 4 <= table->capacity * 3) {
+    return;
+  }
+  table_migrate(table, table->old_capacity);
+
+  U64 capacity = table->capacity;
+  if ((table->count + 1) * 2 > capacity) {
+    capacity *= 2;
+  }
+  table->old          = table->slots;
+  table->old_capacity = table->capacity;
+  table->migrated     = 0;
+  table->slots        = allocate_slots(arena, capacity);
+  table->capacity     = capacity;
+  table->used         = 0;
+}
+
+static Term* table_get(Table* table, Term* key) {
+  table_migrate(table, TABLE_MIGRATE);
+  U64        hash = hash_term(key);
+  TableSlot* slot = probe(table->slots, table->capacity, key, hash);
+  if (slot->key == NULL && table->old != NULL) {
+    slot = probe(table->old, table->old_capacity, key, hash);
+  }
+  return slot->key != NULL ? slot->value : NULL;
+}
+
+static B32 table_remove(Table* table, Term* key) {
+  table_migrate(table, TABLE_MIGRATE);
+  U64 hash    = hash_term(key);
+  B32 removed = false;
+
+  TableSlot* slot = probe(table->slots, table->capacity, key, hash);
+  if (slot->key != NULL) {
+    slot->value = NULL;
+    removed     = true;
+  }
+  if (table->old != NULL) {
+    slot = probe(table->old, table->old_capacity, key, hash);
+    if (slot->key != NULL) {
+      slot->value = NULL;
+      removed     = true;
+    }
+  }
+  if (removed) {
+    table->count--;
+  }
+  return removed;
+}
+
+static void table_set(Arena* arena, Table* table, Term* key, Term* value) {
+  table_migrate(table, TABLE_MIGRATE);
+  U64 hash = hash_term(key);
+
+  if (table->old != NULL) {
+    TableSlot* slot = probe(table->old, table->old_capacity, key, hash);
+    if (slot->key != NULL) {
+      slot->value = NULL;
+      table->count--;
+    }
+  }
+
+  TableSlot* slot = probe(table->slots, table->capacity, key, hash);
+  if (slot->key == NULL) {
+    table_reserve(arena, table);
+    slot = probe(table->slots, table->capacity, key, hash);
+    table->used++;
+    table->count++;
+  }
+  slot->key   = key;
+  slot->value = value;
+  slot->hash  = hash;
+}
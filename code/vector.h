@@ -0,0 +1,441 @@
+// Numeric vectors hold integers or floats, never both, in one contiguous
+// array in the arena. The loops over float vectors that benefit from SIMD are
+// compiled three times: for AVX2, for SSE2, which every x86-64 CPU has, and in
+// plain C for other machines. The set matching the CPU is picked when a
+// context is created.
+//
+// Reductions keep four partial results, one per AVX2 lane, and combine them
+// the same way in every version, so a program prints the same sums on every
+// machine. They can still differ in the last bits from adding the elements one
+// at a time, as "vector-prefix-sum" does.
+//
+// A vector read from a text file has a "source" until all its elements have
+// been parsed; see ingest.h.
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define VECTOR_LANES 4
+
+typedef struct VectorSource VectorSource;
+
+struct Vector {
+  TermKind kind;
+  U64      count;
+  union {
+    I64* integers;
+    F64* numbers;
+  };
+  VectorSource* source;
+};
+
+struct VectorKernels {
+  F64  (*sum)(F64* a, U64 count);
+  F64  (*dot)(F64* a, F64* b, U64 count);
+  F64  (*min)(F64* a, U64 count);
+  F64  (*max)(F64* a, U64 count);
+  void (*add)(F64* out, F64* a, F64* b, U64 count);
+  void (*multiply)(F64* out, F64* a, F64* b, U64 count);
+  void (*scale)(F64* out, F64* a, F64 k, U64 count);
+  I64  (*sum_integers)(I64* a, U64 count);
+};
+
+static Vector* vector_create(Arena* arena, TermKind kind, U64 count) {
+  assert(kind == TERM_INTEGER || kind == TERM_NUMBER);
+  Vector* vector = arena_allocate(arena, Vector, SITE_VECTOR);
+  vector->kind   = kind;
+  vector->count  = count;
+  vector->source = NULL;
+  // Both element types are 8 bytes; 32 keeps AVX2 loads within cache lines.
+  vector->numbers = (F64*) arena_allocate_bytes(arena, count * 8, 32, SITE_VECTOR);
+  return vector;
+}
+
+// A float copy of an integer vector, or the vector itself.
+static Vector* vector_promote(Arena* arena, Vector* vector) {
+  if (vector->kind == TERM_NUMBER) {
+    return vector;
+  }
+  Vector* result = vector_create(arena, TERM_NUMBER, vector->count);
+  for (U64 i = 0; i < vector->count; i++) {
+    result->numbers[i] = vector->integers[i];
+  }
+  return result;
+}
+
+static F64 combine_sum(F64* lanes) {
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// The same choice _mm256_min_pd and _mm256_max_pd make, including for NaN.
+static F64 pick_min(F64 a, F64 b) {
+  return a < b ? a : b;
+}
+
+static F64 pick_max(F64 a, F64 b) {
+  return a > b ? a : b;
+}
+
+// This and scalar_dot are only needed where there is no SSE2.
+#if !defined(__x86_64__)
+static F64 scalar_sum(F64* a, U64 count) {
+  F64 lanes[VECTOR_LANES] = { 0 };
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    for (U64 j = 0; j < VECTOR_LANES; j++) {
+      lanes[j] += a[i + j];
+    }
+  }
+  F64 sum = combine_sum(lanes);
+  for (; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static F64 scalar_dot(F64* a, F64* b, U64 count) {
+  F64 lanes[VECTOR_LANES] = { 0 };
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    for (U64 j = 0; j < VECTOR_LANES; j++) {
+      lanes[j] += a[i + j] * b[i + j];
+    }
+  }
+  F64 sum = combine_sum(lanes);
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+#endif
+
+static F64 scalar_extreme(F64* a, U64 count, F64 (*pick)(F64, F64)) {
+  assert(count > 0);
+  if (count < VECTOR_LANES) {
+    F64 result = a[0];
+    for (U64 i = 1; i < count; i++) {
+      result = pick(a[i], result);
+    }
+    return result;
+  }
+  F64 lanes[VECTOR_LANES];
+  memcpy(lanes, a, sizeof lanes);
+  U64 i = VECTOR_LANES;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    for (U64 j = 0; j < VECTOR_LANES; j++) {
+      lanes[j] = pick(a[i + j], lanes[j]);
+    }
+  }
+  F64 result = pick(pick(lanes[1], lanes[0]), pick(lanes[3], lanes[2]));
+  for (; i < count; i++) {
+    result = pick(a[i], result);
+  }
+  return result;
+}
+
+static F64 scalar_min(F64* a, U64 count) {
+  return scalar_extreme(a, count, pick_min);
+}
+
+static F64 scalar_max(F64* a, U64 count) {
+  return scalar_extreme(a, count, pick_max);
+}
+
+static void scalar_add(F64* out, F64* a, F64* b, U64 count) {
+  for (U64 i = 0; i < count; i++) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+static void scalar_multiply(F64* out, F64* a, F64* b, U64 count) {
+  for (U64 i = 0; i < count; i++) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+static void scalar_scale(F64* out, F64* a, F64 k, U64 count) {
+  for (U64 i = 0; i < count; i++) {
+    out[i] = a[i] * k;
+  }
+}
+
+// Integers wrap around on overflow, as they do in the AVX2 version.
+static I64 scalar_sum_integers(I64* a, U64 count) {
+  U64 sum = 0;
+  for (U64 i = 0; i < count; i++) {
+    sum += (U64) a[i];
+  }
+  return (I64) sum;
+}
+
+#if !defined(__x86_64__)
+static const VectorKernels scalar_kernels = {
+  .sum          = scalar_sum,
+  .dot          = scalar_dot,
+  .min          = scalar_min,
+  .max          = scalar_max,
+  .add          = scalar_add,
+  .multiply     = scalar_multiply,
+  .scale        = scalar_scale,
+  .sum_integers = scalar_sum_integers,
+};
+#endif
+
+#if defined(__x86_64__)
+
+// The SSE2 versions hold the four lanes of the AVX2 ones in two registers.
+static F64 sse2_sum(F64* a, U64 count) {
+  __m128d low  = _mm_setzero_pd();
+  __m128d high = _mm_setzero_pd();
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    low  = _mm_add_pd(low, _mm_loadu_pd(&a[i]));
+    high = _mm_add_pd(high, _mm_loadu_pd(&a[i + 2]));
+  }
+  F64 stored[VECTOR_LANES];
+  _mm_storeu_pd(stored, low);
+  _mm_storeu_pd(&stored[2], high);
+  F64 sum = combine_sum(stored);
+  for (; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static F64 sse2_dot(F64* a, F64* b, U64 count) {
+  __m128d low  = _mm_setzero_pd();
+  __m128d high = _mm_setzero_pd();
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    low  = _mm_add_pd(low, _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+    high = _mm_add_pd(high, _mm_mul_pd(_mm_loadu_pd(&a[i + 2]), _mm_loadu_pd(&b[i + 2])));
+  }
+  F64 stored[VECTOR_LANES];
+  _mm_storeu_pd(stored, low);
+  _mm_storeu_pd(&stored[2], high);
+  F64 sum = combine_sum(stored);
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static F64 sse2_min(F64* a, U64 count) {
+  if (count < VECTOR_LANES) {
+    return scalar_min(a, count);
+  }
+  __m128d low  = _mm_loadu_pd(a);
+  __m128d high = _mm_loadu_pd(&a[2]);
+  U64 i = VECTOR_LANES;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    low  = _mm_min_pd(_mm_loadu_pd(&a[i]), low);
+    high = _mm_min_pd(_mm_loadu_pd(&a[i + 2]), high);
+  }
+  F64 stored[VECTOR_LANES];
+  _mm_storeu_pd(stored, low);
+  _mm_storeu_pd(&stored[2], high);
+  F64 result = pick_min(pick_min(stored[1], stored[0]), pick_min(stored[3], stored[2]));
+  for (; i < count; i++) {
+    result = pick_min(a[i], result);
+  }
+  return result;
+}
+
+static F64 sse2_max(F64* a, U64 count) {
+  if (count < VECTOR_LANES) {
+    return scalar_max(a, count);
+  }
+  __m128d low  = _mm_loadu_pd(a);
+  __m128d high = _mm_loadu_pd(&a[2]);
+  U64 i = VECTOR_LANES;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    low  = _mm_max_pd(_mm_loadu_pd(&a[i]), low);
+    high = _mm_max_pd(_mm_loadu_pd(&a[i + 2]), high);
+  }
+  F64 stored[VECTOR_LANES];
+  _mm_storeu_pd(stored, low);
+  _mm_storeu_pd(&stored[2], high);
+  F64 result = pick_max(pick_max(stored[1], stored[0]), pick_max(stored[3], stored[2]));
+  for (; i < count; i++) {
+    result = pick_max(a[i], result);
+  }
+  return result;
+}
+
+static void sse2_add(F64* out, F64* a, F64* b, U64 count) {
+  U64 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(&out[i], _mm_add_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+  }
+  scalar_add(&out[i], &a[i], &b[i], count - i);
+}
+
+static void sse2_multiply(F64* out, F64* a, F64* b, U64 count) {
+  U64 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(&out[i], _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+  }
+  scalar_multiply(&out[i], &a[i], &b[i], count - i);
+}
+
+static void sse2_scale(F64* out, F64* a, F64 k, U64 count) {
+  __m128d factor = _mm_set1_pd(k);
+  U64 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(&out[i], _mm_mul_pd(_mm_loadu_pd(&a[i]), factor));
+  }
+  scalar_scale(&out[i], &a[i], k, count - i);
+}
+
+static I64 sse2_sum_integers(I64* a, U64 count) {
+  __m128i lanes = _mm_setzero_si128();
+  U64 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    lanes = _mm_add_epi64(lanes, _mm_loadu_si128((__m128i*) &a[i]));
+  }
+  I64 stored[2];
+  _mm_storeu_si128((__m128i*) stored, lanes);
+  return (I64) ((U64) scalar_sum_integers(stored, 2) + (U64) scalar_sum_integers(&a[i], count - i));
+}
+
+static const VectorKernels sse2_kernels = {
+  .sum          = sse2_sum,
+  .dot          = sse2_dot,
+  .min          = sse2_min,
+  .max          = sse2_max,
+  .add          = sse2_add,
+  .multiply     = sse2_multiply,
+  .scale        = sse2_scale,
+  .sum_integers = sse2_sum_integers,
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static F64 avx2_sum(F64* a, U64 count) {
+  __m256d lanes = _mm256_setzero_pd();
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    lanes = _mm256_add_pd(lanes, _mm256_loadu_pd(&a[i]));
+  }
+  F64 stored[VECTOR_LANES];
+  _mm256_storeu_pd(stored, lanes);
+  F64 sum = combine_sum(stored);
+  for (; i < count; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+AVX2 static F64 avx2_dot(F64* a, F64* b, U64 count) {
+  __m256d lanes = _mm256_setzero_pd();
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    __m256d product = _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+    lanes = _mm256_add_pd(lanes, product);
+  }
+  F64 stored[VECTOR_LANES];
+  _mm256_storeu_pd(stored, lanes);
+  F64 sum = combine_sum(stored);
+  for (; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+AVX2 static F64 avx2_min(F64* a, U64 count) {
+  if (count < VECTOR_LANES) {
+    return scalar_min(a, count);
+  }
+  __m256d lanes = _mm256_loadu_pd(a);
+  U64 i = VECTOR_LANES;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    lanes = _mm256_min_pd(_mm256_loadu_pd(&a[i]), lanes);
+  }
+  F64 stored[VECTOR_LANES];
+  _mm256_storeu_pd(stored, lanes);
+  F64 result = pick_min(pick_min(stored[1], stored[0]), pick_min(stored[3], stored[2]));
+  for (; i < count; i++) {
+    result = pick_min(a[i], result);
+  }
+  return result;
+}
+
+AVX2 static F64 avx2_max(F64* a, U64 count) {
+  if (count < VECTOR_LANES) {
+    return scalar_max(a, count);
+  }
+  __m256d lanes = _mm256_loadu_pd(a);
+  U64 i = VECTOR_LANES;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    lanes = _mm256_max_pd(_mm256_loadu_pd(&a[i]), lanes);
+  }
+  F64 stored[VECTOR_LANES];
+  _mm256_storeu_pd(stored, lanes);
+  F64 result = pick_max(pick_max(stored[1], stored[0]), pick_max(stored[3], stored[2]));
+  for (; i < count; i++) {
+    result = pick_max(a[i], result);
+  }
+  return result;
+}
+
+AVX2 static void avx2_add(F64* out, F64* a, F64* b, U64 count) {
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    _mm256_storeu_pd(&out[i], _mm256_add_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+  scalar_add(&out[i], &a[i], &b[i], count - i);
+}
+
+AVX2 static void avx2_multiply(F64* out, F64* a, F64* b, U64 count) {
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    _mm256_storeu_pd(&out[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+  scalar_multiply(&out[i], &a[i], &b[i], count - i);
+}
+
+AVX2 static void avx2_scale(F64* out, F64* a, F64 k, U64 count) {
+  __m256d factor = _mm256_set1_pd(k);
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    _mm256_storeu_pd(&out[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), factor));
+  }
+  scalar_scale(&out[i], &a[i], k, count - i);
+}
+
+AVX2 static I64 avx2_sum_integers(I64* a, U64 count) {
+  __m256i lanes = _mm256_setzero_si256();
+  U64 i = 0;
+  for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+    lanes = _mm256_add_epi64(lanes, _mm256_loadu_si256((__m256i*) &a[i]));
+  }
+  I64 stored[VECTOR_LANES];
+  _mm256_storeu_si256((__m256i*) stored, lanes);
+  return (I64) ((U64) scalar_sum_integers(stored, VECTOR_LANES) + (U64) scalar_sum_integers(&a[i], count - i));
+}
+
+static const VectorKernels avx2_kernels = {
+  .sum          = avx2_sum,
+  .dot          = avx2_dot,
+  .min          = avx2_min,
+  .max          = avx2_max,
+  .add          = avx2_add,
+  .multiply     = avx2_multiply,
+  .scale        = avx2_scale,
+  .sum_integers = avx2_sum_integers,
+};
+
+#endif
+
+static const VectorKernels* vector_select_kernels(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &avx2_kernels;
+  }
+  return &sse2_kernels;
+#else
+  return &scalar_kernels;
+#endif
+}
@@ -0,0 +1,44 @@
+// The embedding interface. Build with "-DVLISP_LIBRARY" to leave out "main".
+//
+// Each context owns its arena, environment, output buffer and random state,
+// so any number of them may be used at once as long as a single context is
+// only used by one thread at a time.
+
+#ifndef VLISP_H
+#define VLISP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct VlispContext VlispContext;
+
+// Receives everything a context prints. When it is NULL, output goes to
+// standard output.
+typedef void (*VlispOutputFn)(void* user, unsigned char* data, unsigned long long size);
+
+// Reserves "capacity" bytes of address space for the context's arena.
+VlispContext* vlisp_create(unsigned long long capacity, VlispOutputFn output, void* user);
+
+void vlisp_seed(VlispContext* context, unsigned long long seed);
+
+// Evaluates every form in "source", keeping its definitions for later calls.
+// Returns zero, or -1 when evaluation stopped at an error.
+int vlisp_evaluate(VlispContext* context, const char* source, unsigned long long size);
+
+// Limits every later call to vlisp_evaluate to "steps" evaluated terms,
+// "memory" more arena bytes, calls nested "depth" deep and "milliseconds" of
+// wall-clock time. A limit of zero is not enforced. A call that reaches a
+// limit prints what it had used and returns -1.
+void vlisp_limit(
+  VlispContext* context, unsigned long long steps, unsigned long long memory,
+  unsigned long long depth, unsigned long long milliseconds
+);
+
+void vlisp_destroy(VlispContext* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
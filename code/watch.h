@@ -0,0 +1,307 @@
+// Watch mode keeps the interpreter alive and, whenever the program's file
+// changes, evaluates again only what the change can affect.
+//
+// Top-level forms are compared by the hash of their text. A definition is
+// matched with the old one of the same name, any other form with an old form
+// of the same text. A form that is new or changed is evaluated again, and so
+// is every form that mentions a name defined by such a form, transitively,
+// since procedures capture the definitions they were made with. Forms that
+// are gone leave their definitions in place.
+//
+// Each version of the file is parsed and compared in a scratch arena of its
+// own, and only the forms that are evaluated are copied into the context's
+// arena, just before they are. The scratch arenas take turns: one holds the
+// version last evaluated, which the next is compared with, and the other is
+// emptied before the next version is parsed into it. So the context's arena
+// grows only by what the forms evaluated leave behind.
+
+#define WATCH_INTERVAL_US 50000
+
+typedef struct {
+  Term*  term;
+  U64    hash;
+  String name;
+  B32    dirty;
+} WatchedForm;
+
+typedef struct {
+  WatchedForm* forms;
+  U64          count;
+} WatchedProgram;
+
+// The name a (define name ...) or (define (name ...) ...) form defines, or an
+// empty string.
+static String defined_name(Term* term) {
+  String none = { .data = NULL, .size = 0 };
+  if (term == NULL || term->kind != TERM_LIST || is_nil_term(term)) {
+    return none;
+  }
+  Term* head = term->list.head;
+  Term* rest = term->list.tail;
+  if (head->kind != TERM_ATOM || !strings_equal(head->atom, string("define")) ||
+      rest->kind != TERM_LIST || is_nil_term(rest)) {
+    return none;
+  }
+  Term* header = rest->list.head;
+  if (header->kind == TERM_LIST && !is_nil_term(header)) {
+    header = header->list.head;
+  }
+  return header->kind == TERM_ATOM ? header->atom : none;
+}
+
+static Term* make_name(Arena* arena, String name) {
+  Term* key = arena_allocate(arena, Term, SITE_OTHER);
+  key->kind = TERM_ATOM;
+  key->atom = name;
+  return key;
+}
+
+static Term* make_hash(Arena* arena, U64 hash) {
+  Term* key    = arena_allocate(arena, Term, SITE_OTHER);
+  key->kind    = TERM_INTEGER;
+  key->integer = hash;
+  return key;
+}
+
+// Whether "term" mentions any atom in "names".
+static B32 mentions(Table* names, Term* term) {
+  for (; term != NULL; term = term->list.tail) {
+    if (term->kind == TERM_ATOM) {
+      return table_get(names, term) != NULL;
+    }
+    if (term->kind != TERM_LIST) {
+      return false;
+    }
+    if (mentions(names, term->list.head)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether every parenthesis outside a string is closed, so that a file
+// saved in the middle of an edit is not parsed.
+static B32 balanced(String source) {
+  I64 depth  = 0;
+  B32 quoted = false;
+  for (U64 i = 0; i < source.size && depth >= 0; i++) {
+    U8 c = source.data[i];
+    if (quoted && c == '\\') {
+      i++;
+    } else if (c == '"') {
+      quoted = !quoted;
+    } else if (!quoted && c == '(') {
+      depth++;
+    } else if (!quoted && c == ')') {
+      depth--;
+    }
+  }
+  return depth == 0 && !quoted;
+}
+
+// The text is copied, since the file may change under a mapping of it. A
+// program that cannot be parsed yet has no forms.
+static WatchedProgram watch_parse(Arena* arena, char* path) {
+  WatchedProgram program = { .forms = NULL, .count = 0 };
+  int            fd      = open(path, O_RDONLY);
+  if (fd == -1) {
+    return program;
+  }
+  String source = read_all(arena, fd);
+  close(fd);
+  if (!balanced(source)) {
+    return program;
+  }
+
+  // Forms are gathered in a list, head first, then copied out in order.
+  Term* forms = NULL;
+  for (String input = clear_blanks(source); input.size > 0;) {
+    ParseResult parsed = parse(arena, input);
+    Term*       hash   = make_hash(arena, hash_bytes(input.data, parsed.rest.data - input.data));
+    Term*       form   = arena_allocate(arena, Term, SITE_OTHER);
+    Term*       cell   = arena_allocate(arena, Term, SITE_OTHER);
+    form->kind      = TERM_LIST;
+    form->list.head = parsed.term;
+    form->list.tail = hash;
+    cell->kind      = TERM_LIST;
+    cell->list.head = form;
+    cell->list.tail = forms;
+    forms           = cell;
+    input           = clear_blanks(parsed.rest);
+    program.count++;
+  }
+
+  program.forms = (WatchedForm*) arena_allocate_bytes(
+    arena, program.count * sizeof(WatchedForm), _Alignof(WatchedForm), SITE_OTHER
+  );
+  U64 index = program.count;
+  for (Term* i = forms; i != NULL; i = i->list.tail) {
+    WatchedForm* form = &program.forms[--index];
+    form->term  = i->list.head->list.head;
+    form->hash  = (U64) i->list.head->list.tail->integer;
+    form->name  = defined_name(form->term);
+    form->dirty = true;
+  }
+  return program;
+}
+
+// Marks the forms of "program" that differ from "old", then those that
+// depend on them, and returns how many are marked.
+static U64 watch_compare(Arena* arena, WatchedProgram old, WatchedProgram program) {
+  Table* definitions = table_create(arena);
+  Table* expressions = table_create(arena);
+  for (U64 i = 0; i < old.count; i++) {
+    WatchedForm* form  = &old.forms[i];
+    Term*        value = make_hash(arena, form->hash);
+    if (form->name.size > 0) {
+      table_set(arena, definitions, make_name(arena, form->name), value);
+    } else {
+      table_set(arena, expressions, value, value);
+    }
+  }
+
+  Table* changed = table_create(arena);
+  for (U64 i = 0; i < program.count; i++) {
+    WatchedForm* form = &program.forms[i];
+    Term*        hash = make_hash(arena, form->hash);
+    if (form->name.size > 0) {
+      Term* name     = make_name(arena, form->name);
+      Term* previous = table_get(definitions, name);
+      form->dirty    = previous == NULL || (U64) previous->integer != form->hash;
+      if (form->dirty) {
+	table_set(arena, changed, name, name);
+      }
+    } else {
+      form->dirty = table_get(expressions, hash) == NULL;
+    }
+  }
+
+  U64 dirty = 0;
+  for (B32 growing = true; growing;) {
+    growing = false;
+    dirty   = 0;
+    for (U64 i = 0; i < program.count; i++) {
+      WatchedForm* form = &program.forms[i];
+      if (!form->dirty && changed->count > 0 && mentions(changed, form->term)) {
+	form->dirty = true;
+	if (form->name.size > 0) {
+	  Term* name = make_name(arena, form->name);
+	  table_set(arena, changed, name, name);
+	  growing = true;
+	}
+      }
+      dirty += form->dirty;
+    }
+  }
+  return dirty;
+}
+
+// A copy of a parsed term, text included, that does not depend on the arena it
+// was parsed in. The cells of a list are copied one after another, as the
+// parser made them.
+static Term* copy_parsed(Arena* arena, Term* term) {
+  Term*  first = NULL;
+  Term** link  = &first;
+  for (; term != NULL; term = term->list.tail) {
+    Term* copy = arena_allocate(arena, Term, SITE_PARSER);
+    *copy      = *term;
+    *link      = copy;
+    if (term->kind == TERM_ATOM || term->kind == TERM_STRING) {
+      copy->atom.data = arena_allocate_bytes(arena, term->atom.size, 1, SITE_STRING);
+      memcpy(copy->atom.data, term->atom.data, term->atom.size);
+    }
+    if (term->kind != TERM_LIST) {
+      return first;
+    }
+    copy->list.head = copy_parsed(arena, term->list.head);
+    copy->list.tail = NULL;
+    link            = &copy->list.tail;
+  }
+  return first;
+}
+
+// Evaluates the marked forms in order. A form that fails, and every marked
+// form after it, is left marked so the next change evaluates it again. A
+// form's copy is taken after its mark, so it goes with the rest of its memory
+// when it leaves nothing behind.
+static void watch_evaluate(Context* context, WatchedProgram program, B32 optimize) {
+  jmp_buf      failure;
+  volatile U64 form = 0;
+  context->failure = &failure;
+  if (context->arena.governor != NULL) {
+    governor_start(context->arena.governor);
+  }
+  if (setjmp(failure) == 0) {
+    for (; form < program.count; form++) {
+      if (program.forms[form].dirty) {
+	U64   mark = arena_mark(&context->arena);
+	Term* term = copy_parsed(&context->arena, program.forms[form].term);
+	evaluate_form(context, form, term, mark, optimize);
+	program.forms[form].dirty = false;
+      }
+    }
+  }
+  context->failure = NULL;
+
+  // The hash of a form that has not been evaluated matches nothing.
+  for (; form < program.count; form++) {
+    if (program.forms[form].dirty) {
+      program.forms[form].hash = 0;
+    }
+  }
+  flush(&context->output);
+}
+
+static void watch(Context* context, char* path, B32 optimize) {
+  Output* output = &context->output;
+  Arena   scratch[2];
+  U64     current = 0;
+  arena_initialize(&scratch[0], context->arena.capacity);
+  arena_initialize(&scratch[1], context->arena.capacity);
+
+  struct stat last;
+  assert(stat(path, &last) == 0);
+  WatchedProgram program = watch_parse(&scratch[current], path);
+  watch_evaluate(context, program, optimize);
+
+  while (true) {
+    usleep(WATCH_INTERVAL_US);
+    struct stat info;
+    if (stat(path, &info) != 0 || (info.st_mtim.tv_sec == last.st_mtim.tv_sec &&
+				   info.st_mtim.tv_nsec == last.st_mtim.tv_nsec &&
+				   info.st_size == last.st_size)) {
+      continue;
+    }
+    last = info;
+
+    Arena* next = &scratch[1 - current];
+    arena_restore(next, 0);
+
+    U64            started = governor_now();
+    WatchedProgram changed = watch_parse(next, path);
+    if (changed.forms == NULL) {
+      print(output, string("== "));
+      print(output, string(path));
+      print(output, string(" cannot be read or parsed yet ==\n"));
+      flush(output);
+      continue;
+    }
+    U64 dirty = watch_compare(next, program, changed);
+    program   = changed;
+    current   = 1 - current;
+
+    print(output, string("== "));
+    print(output, string(path));
+    print(output, string(" changed, evaluating "));
+    print_int(output, dirty);
+    print(output, string(" of "));
+    print_int(output, program.count);
+    print(output, string(" forms ==\n"));
+    watch_evaluate(context, program, optimize);
+
+    print(output, string("== done in "));
+    print_float(output, (governor_now() - started) / 1e6);
+    print(output, string(" ms ==\n"));
+    flush(output);
+  }
+}
@@ -0,0 +1,63 @@
+// Embeds vlisp: evaluates a program in a context, keeps its definitions for a
+// second call, and creates and destroys many contexts to show that each one
+// gives back all of its memory. Build it from the top of the repository with
+//
+//   ./build.sh
+//   gcc -I code examples/embed.c build/libvlisp.a -lm -pthread -o build/embed
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vlisp.h"
+
+#define CYCLES 200
+
+static void print_output(void* user, unsigned char* data, unsigned long long size) {
+  fwrite(data, 1, size, stdout);
+}
+
+static void discard_output(void* user, unsigned char* data, unsigned long long size) {
+}
+
+static void evaluate(VlispContext* context, const char* source) {
+  if (vlisp_evaluate(context, source, strlen(source)) != 0) {
+    printf("Evaluation stopped at an error.\n");
+  }
+}
+
+// The process's address space, in kilobytes.
+static unsigned long long address_space(void) {
+  FILE*              status = fopen("/proc/self/status", "r");
+  char               line[256];
+  unsigned long long size   = 0;
+  while (status != NULL && fgets(line, sizeof line, status) != NULL) {
+    if (sscanf(line, "VmSize: %llu", &size) == 1) {
+      break;
+    }
+  }
+  if (status != NULL) {
+    fclose(status);
+  }
+  return size;
+}
+
+int main(void) {
+  VlispContext* context = vlisp_create(1ull << 32, print_output, NULL);
+  evaluate(context, "(define (sum n) (if (= n 0) 0 (+ n (sum (- n 1)))))");
+  evaluate(context, "(sum 100000)");
+  vlisp_limit(context, 0, 0, 500, 0);
+  evaluate(context, "(sum 1000)");
+  vlisp_destroy(context);
+
+  // Each context maps an arena and an evaluation stack as large as its
+  // capacity, both of which vlisp_destroy must unmap.
+  unsigned long long before = address_space();
+  for (int i = 0; i < CYCLES; i++) {
+    context = vlisp_create(1ull << 30, discard_output, NULL);
+    evaluate(context, "(define (sum n) (if (= n 0) 0 (+ n (sum (- n 1))))) (sum 10)");
+    vlisp_destroy(context);
+  }
+  unsigned long long after = address_space();
+  printf("%d contexts grew the address space by %llu kilobytes.\n", CYCLES, after - before);
+  return after - before < (1ull << 20) ? 0 : 1;
+}